@@ -27,71 +27,406 @@
 
 #include "audio_stream_pxtone.h"
 
+#include "pxtone_render_thread.h"
+
 #include "core/io/file_access.h"
+#include "core/math/math_funcs.h"
+#include "core/object/worker_thread_pool.h"
+#include "core/os/thread.h"
+#include "servers/audio_server.h"
+
+// With lazy_woices, woices first played within this many seconds are readied
+// before playback starts; the rest are readied on a worker thread.
+#define PXTONE_LAZY_WOICE_LEAD 2.0f
+
+// How many loop bodies the loop cache renders at most, waiting for two in a
+// row to match, before it gives up and leaves the song to live synthesis.
+#define PXTONE_LOOP_CACHE_MAX_LOOPS 8
+
+// How many seconds render_to_wav() renders at a time.
+#define PXTONE_RENDER_SLICE 20
+
+static_assert(sizeof(AudioFrame) == sizeof(float) * 2, "AudioFrame must be two interleaved floats.");
+
+static pxtnMOOLIMIT _get_moo_limit(AudioStreamPxTone::LimitMode p_mode) {
+	switch (p_mode) {
+		case AudioStreamPxTone::LIMIT_MODE_SOFT:
+			return pxtnMOOLIMIT_soft;
+		case AudioStreamPxTone::LIMIT_MODE_NONE:
+			return pxtnMOOLIMIT_none;
+		default:
+			return pxtnMOOLIMIT_clamp;
+	}
+}
+
+static void _pxtone_prepare(const pxtnService &p_svc, mooState &r_state) {
+	r_state = mooState();
+	p_svc.moo_tones_ready(r_state);
+
+	pxtnVOMITPREPARATION prep;
+	memset(&prep, 0, sizeof(prep));
+	prep.master_volume = 1.0f;
+	prep.flags = pxtnVOMITPREPFLAG_loop;
+	p_svc.moo_preparation(&prep, r_state);
+}
+
+static void _pxtone_f32_to_s16(const float *p_src, int16_t *p_dst, int32_t p_num) {
+	// Clamped output is a multiple of 1 / 32768 within range, so it's stored exactly.
+	for (int32_t i = 0; i < p_num; i++) {
+		p_dst[i] = (int16_t)CLAMP(Math::round(p_src[i] * 32768.0f), -32768.0f, 32767.0f);
+	}
+}
 
-constexpr float i16_f32mul = 1.0f / 32768.0f;
+// Renders up to [p_frames] frames of 16-bit stereo to [p_dst]. Returns how many
+// were rendered before the song ended or [p_cancelled] was set.
+static int32_t _pxtone_render_s16(const pxtnService &p_svc, mooState &r_state, int16_t *p_dst, int32_t p_frames, pxtnMOOLIMIT p_limit, const SafeFlag &p_cancelled) {
+	const int32_t chunk_frames = 1024;
+	float scratch[chunk_frames * 2];
+
+	int32_t rendered = 0;
+	while (rendered < p_frames && !p_cancelled.is_set()) {
+		int32_t count = MIN(p_frames - rendered, chunk_frames);
+		int filled_frames = 0;
+		bool ok = p_svc.Moo_f32(r_state, scratch, count, &filled_frames, p_limit);
+		_pxtone_f32_to_s16(scratch, p_dst, filled_frames * 2);
+		p_dst += filled_frames * 2;
+		rendered += filled_frames;
+		if (!ok || filled_frames < count) {
+			break;
+		}
+	}
+	return rendered;
+}
+
+bool PxToneLoopCache::_render(const pxtnService &p_svc, mooState &r_state, int32_t p_frames, pxtnMOOLIMIT p_limit) {
+	uint32_t size = frames.size();
+	frames.resize(size + uint32_t(p_frames) * 2);
+	return _pxtone_render_s16(p_svc, r_state, frames.ptr() + size, p_frames, p_limit, cancelled) == p_frames;
+}
+
+bool PxToneLoopCache::build(const pxtnService &p_svc, pxtnMOOLIMIT p_limit) {
+	mooState state;
+	_pxtone_prepare(p_svc, state);
+	song_end = p_svc.moo_get_end_sample(state);
+	if (song_end <= 0) {
+		return false;
+	}
+
+	// The first pass ends by jumping back to the repeat measure.
+	if (!_render(p_svc, state, song_end, p_limit) || state.num_loop != 1) {
+		return false;
+	}
+	loop_length = song_end - state.smp_count;
+	if (loop_length <= 0) {
+		return false;
+	}
+
+	// Every loop restarts the units the same way, so loops only differ by the
+	// delay tails carried into them. Once two in a row match, those have settled.
+	int32_t body = song_end - loop_length;
+	for (int i = 0; i < PXTONE_LOOP_CACHE_MAX_LOOPS; i++) {
+		if (!_render(p_svc, state, loop_length, p_limit)) {
+			return false;
+		}
+		const int16_t *p_body = frames.ptr() + size_t(body) * 2;
+		if (!memcmp(p_body, p_body + size_t(loop_length) * 2, size_t(loop_length) * 2 * sizeof(int16_t))) {
+			frame_num = body + loop_length;
+			loop_start = body;
+			frames.resize(uint32_t(frame_num) * 2);
+			return true;
+		}
+		body += loop_length;
+	}
+	return false;
+}
+
+int32_t PxToneLoopCache::get_position(const mooState &p_state) const {
+	// Every loop takes smp_count back by loop_length, while frames go on.
+	int64_t pos = p_state.smp_count + int64_t(p_state.num_loop) * loop_length;
+	if (pos < frame_num) {
+		return int32_t(pos);
+	}
+	return loop_start + int32_t((pos - loop_start) % loop_length);
+}
+
+int32_t PxToneLoopCache::get_song_sample(int32_t p_pos) const {
+	if (p_pos < song_end) {
+		return p_pos;
+	}
+	return song_end - loop_length + (p_pos - song_end) % loop_length;
+}
 
 int AudioStreamPlaybackPxTone::_mix_internal(AudioFrame *p_buffer, int p_frames) {
 	if (!active) {
 		return 0;
 	}
 
-	int todo = p_frames;
+	if (!ring.is_empty()) {
+		return _mix_ring(p_buffer, p_frames);
+	}
+
+	// start() and seek() only hold the lock to swap in a new state.
+	if (!render_mutex.try_lock()) {
+		for (int i = 0; i < p_frames; i++) {
+			p_buffer[i] = AudioFrame(0, 0);
+		}
+		return p_frames;
+	}
+
+	// The song is rendered as stereo, so it can be written straight into the frames.
+	int filled_frames = 0;
+	bool ret = _render(reinterpret_cast<float *>(p_buffer), p_frames, &filled_frames);
+	render_mutex.unlock();
+
+	//EOF
+	if (!ret) {
+		//fill remainder with silence
+		for (int i = filled_frames; i < p_frames; i++) {
+			p_buffer[i] = AudioFrame(0, 0);
+		}
+		active = false;
+		return filled_frames;
+	}
+
+	return p_frames;
+}
+
+float AudioStreamPlaybackPxTone::get_stream_sampling_rate() {
+	return sample_rate;
+}
+
+int AudioStreamPlaybackPxTone::mix(AudioFrame *p_buffer, float p_rate_scale, int p_frames) {
+	// A song rendered at the output rate only needs the resampler to apply the pitch scale.
+	bool direct = p_rate_scale == 1.0f && sample_rate == AudioServer::get_singleton()->get_mix_rate();
+	if (!direct) {
+		if (mixing_direct) {
+			mixing_direct = false;
+			begin_resample();
+		}
+		return AudioStreamPlaybackResampled::mix(p_buffer, p_rate_scale, p_frames);
+	}
+
+	mixing_direct = true;
+	return _mix_internal(p_buffer, p_frames);
+}
+
+int AudioStreamPlaybackPxTone::_mix_ring(AudioFrame *p_buffer, int p_frames) {
+	uint32_t read = ring_read.get();
+	uint32_t generation = flush_generation.get();
+	if (generation != flush_generation_seen) {
+		flush_generation_seen = generation;
+		read = flush_pos.get();
+	}
+
+	// Checked before the write position, so every frame of an ended song is seen.
+	bool ended = render_ended.is_set();
+	uint32_t available = ring_write.get() - read;
+	int frames = MIN((uint32_t)p_frames, available);
+
+	for (int i = 0; i < frames; i++) {
+		p_buffer[i] = ring[(read + i) & ring_mask];
+	}
+	ring_read.set(read + frames);
+
+	if (frames < p_frames) {
+		for (int i = frames; i < p_frames; i++) {
+			p_buffer[i] = AudioFrame(0, 0);
+		}
+		if (ended) {
+			active = false;
+			return frames;
+		}
+		pxtn_stream->render_ahead_underruns.increment();
+	}
+
+	return p_frames;
+}
+
+void AudioStreamPlaybackPxTone::_render_ahead() {
+	MutexLock lock(render_mutex);
+	if (!active || render_ended.is_set()) {
+		return;
+	}
+
+	uint32_t write = ring_write.get();
+	uint32_t free_frames = ring.size() - (write - ring_read.get());
+	while (free_frames > 0) {
+		uint32_t offset = write & ring_mask;
+		int frames = MIN(free_frames, ring.size() - offset);
+
+		int filled_frames = 0;
+		bool ret = _render(reinterpret_cast<float *>(&ring[offset]), frames, &filled_frames);
+		write += filled_frames;
+		free_frames -= filled_frames;
+		ring_write.set(write);
+
+		if (!ret) {
+			render_ended.set();
+			break;
+		}
+	}
+}
+
+// Renders from the loop cache once it's ready and live otherwise. Returns false
+// once the song has ended, after [r_filled] frames.
+bool AudioStreamPlaybackPxTone::_render(float *p_buffer, int p_frames, int *r_filled) {
+	if (cache_pos < 0 && loop_cache && loop_cache->ready.is_set()) {
+		cache_pos = loop_cache->get_position(state);
+	}
+	if (cache_pos >= 0) {
+		return _render_cache(p_buffer, p_frames, r_filled);
+	}
 
-	int frames_mixed_this_step = p_frames;
 	state.params.b_loop = pxtn_stream->loop;
+	bool ret = svc->Moo_f32(state, p_buffer, p_frames, r_filled, _get_moo_limit(pxtn_stream->limit_mode));
+	return ret && !state.end_vomit;
+}
 
-	while (todo && active) {
-		int16_t imm_buffer[4096];
+bool AudioStreamPlaybackPxTone::_render_cache(float *p_buffer, int p_frames, int *r_filled) {
+	const PxToneLoopCache &cache = *loop_cache;
+	bool loop = pxtn_stream->loop;
+	bool ended = false;
 
-		int todo_samples = todo * 2;
-		int samples = todo_samples > 4096 ? 4096 : todo_samples;
-		int filled_bytes = 0;
-		bool ret = svc->Moo(state, imm_buffer, samples * sizeof(int16_t), &filled_bytes);
-		int filled_frames = filled_bytes / (sizeof(int16_t) * 2);
-		todo -= filled_frames;
+	int filled_frames = 0;
+	while (filled_frames < p_frames) {
+		int32_t end = cache.frame_num;
+		if (!loop) {
+			// Without looping, the song ends where the current pass through it does,
+			// one frame short like Moo_f32.
+			end = cache.song_end;
+			if (cache_pos >= cache.song_end) {
+				end += ((cache_pos - cache.song_end) / cache.loop_length + 1) * cache.loop_length;
+			}
+			end -= 1;
+		}
 
-		for (int i = 0; i < filled_frames; i++) {
-			*p_buffer++ = AudioFrame(imm_buffer[2 * i] * i16_f32mul, imm_buffer[2 * i + 1] * i16_f32mul);
+		int frames = MIN(p_frames - filled_frames, end - cache_pos);
+		const int16_t *src = cache.frames.ptr() + size_t(cache_pos) * 2;
+		float *dst = p_buffer + filled_frames * 2;
+		for (int i = 0; i < frames * 2; i++) {
+			dst[i] = src[i] * (1.0f / 32768.0f);
 		}
+		filled_frames += frames;
+		cache_pos += frames;
 
-		//EOF
-		if (!ret || state.end_vomit) {
-			frames_mixed_this_step = p_frames - todo;
-			//fill remainder with silence
-			for (int i = p_frames - todo; i < p_frames; i++) {
-				*p_buffer++ = AudioFrame(0, 0);
+		if (cache_pos == end) {
+			if (!loop) {
+				ended = true;
+				break;
 			}
-			active = false;
-			todo = 0;
+			cache_pos = cache.loop_start;
 		}
 	}
 
-	return frames_mixed_this_step;
+	for (int i = filled_frames * 2; i < p_frames * 2; i++) {
+		p_buffer[i] = 0;
+	}
+	*r_filled = filled_frames;
+	return !ended;
 }
 
-float AudioStreamPlaybackPxTone::get_stream_sampling_rate() {
-	return pxtn_stream->sample_rate;
+void AudioStreamPlaybackPxTone::_flush_ring() {
+	flush_pos.set(ring_write.get());
+	flush_generation.increment();
+	render_ended.clear();
+}
+
+void AudioStreamPlaybackPxTone::_prepare(mooState &r_state) const {
+	_pxtone_prepare(*svc, r_state);
+}
+
+int32_t AudioStreamPlaybackPxTone::_get_seek_sample(double p_time) const {
+	if (p_time < 0) {
+		p_time = 0;
+	} else if (p_time >= pxtn_stream->get_length()) {
+		p_time = 0;
+	}
+	return int32_t(sample_rate * p_time);
+}
+
+void AudioStreamPlaybackPxTone::_seek(double p_time, mooState &r_state) const {
+	int32_t target = _get_seek_sample(p_time);
+	int32_t interval = seek_index ? seek_index->interval : 0;
+
+	// Start from the closest snapshot before the target.
+	bool restored = false;
+	if (interval > 0) {
+		MutexLock lock(seek_index->mutex);
+		if (!seek_index->snapshots.empty()) {
+			size_t idx = MIN(size_t(target / interval), seek_index->snapshots.size() - 1);
+			r_state = seek_index->snapshots[idx];
+			restored = true;
+		}
+	}
+	if (!restored) {
+		_prepare(r_state);
+		if (interval > 0) {
+			MutexLock lock(seek_index->mutex);
+			if (seek_index->snapshots.empty()) {
+				seek_index->snapshots.push_back(r_state);
+			}
+		}
+	}
+
+	// Skip to the target so notes, delays and portamento are where they
+	// would have been, recording the snapshots passed on the way.
+	int num_loop = r_state.num_loop;
+	while (r_state.smp_count < target && !r_state.end_vomit) {
+		int32_t end = target;
+		if (interval > 0) {
+			end = MIN(end, (r_state.smp_count / interval + 1) * interval);
+		}
+		svc->Moo_Skip(r_state, end - r_state.smp_count);
+
+		if (r_state.num_loop != num_loop) {
+			// The song repeats before the target, which can't be reached.
+			break;
+		}
+		if (interval > 0 && r_state.smp_count % interval == 0) {
+			MutexLock lock(seek_index->mutex);
+			if (seek_index->snapshots.size() == size_t(r_state.smp_count / interval)) {
+				seek_index->snapshots.push_back(r_state);
+			}
+		}
+	}
 }
 
 void AudioStreamPlaybackPxTone::start(double p_from_pos) {
-	state = mooState();
-	svc->tones_ready(state);
+	mooState new_state;
+	int32_t new_cache_pos = -1;
+	if (loop_cache && loop_cache->ready.is_set()) {
+		new_cache_pos = _get_seek_sample(p_from_pos) % loop_cache->song_end;
+	} else {
+		_seek(p_from_pos, new_state);
+	}
 
-	pxtnVOMITPREPARATION prep;
-	memset(&prep, 0, sizeof(prep));
-	prep.master_volume = 1.0f;
-	prep.flags = pxtnVOMITPREPFLAG_loop;
-	svc->moo_preparation(&prep, state);
+	{
+		MutexLock lock(render_mutex);
+		std::swap(state, new_state);
+		cache_pos = new_cache_pos;
+		active = true;
+		loops = 0;
+		if (!ring.is_empty()) {
+			_flush_ring();
+		}
+	}
 
-	active = true;
-	loops = 0;
-	seek(p_from_pos);
-	begin_resample();
+	if (!ring.is_empty()) {
+		// Fill the ring before the first mix pulls frames from it.
+		_render_ahead();
+		PxToneRenderThread::get_singleton()->add_playback(this);
+	}
+
+	// The resampler is primed by mix() once it is actually needed, so no frames are
+	// rendered into it and then skipped by the direct path.
+	mixing_direct = true;
 }
 
 void AudioStreamPlaybackPxTone::stop() {
 	active = false;
+	if (!ring.is_empty()) {
+		PxToneRenderThread::get_singleton()->remove_playback(this);
+	}
 }
 
 bool AudioStreamPlaybackPxTone::is_playing() const {
@@ -103,7 +438,16 @@ int AudioStreamPlaybackPxTone::get_loop_count() const {
 }
 
 double AudioStreamPlaybackPxTone::get_playback_position() const {
-	return double(state.smp_count % svc->moo_get_total_sample()) / pxtn_stream->sample_rate;
+	int64_t total = svc->moo_get_total_sample();
+	int64_t position = cache_pos >= 0 ? loop_cache->get_song_sample(cache_pos) : state.smp_count;
+	if (!ring.is_empty()) {
+		// The render thread is ahead of what has been heard by what is still in the ring.
+		position -= int64_t(ring_write.get() - ring_read.get());
+		if (position < 0) {
+			position += total;
+		}
+	}
+	return double(position % total) / sample_rate;
 }
 
 void AudioStreamPlaybackPxTone::seek(double p_time) {
@@ -111,50 +455,73 @@ void AudioStreamPlaybackPxTone::seek(double p_time) {
 		return;
 	}
 
-	if (p_time < 0) {
-		p_time = 0;
-	} else if (p_time >= pxtn_stream->get_length()) {
-		p_time = 0;
+	mooState new_state;
+	int32_t new_cache_pos = -1;
+	if (loop_cache && loop_cache->ready.is_set()) {
+		new_cache_pos = _get_seek_sample(p_time) % loop_cache->song_end;
+	} else {
+		_seek(p_time, new_state);
 	}
 
-	state.smp_count = uint32_t(pxtn_stream->sample_rate * p_time);
+	{
+		MutexLock lock(render_mutex);
+		std::swap(state, new_state);
+		cache_pos = new_cache_pos;
+		if (!ring.is_empty()) {
+			_flush_ring();
+		}
+	}
+
+	if (!ring.is_empty()) {
+		_render_ahead();
+	}
 }
 
 void AudioStreamPlaybackPxTone::tag_used_streams() {
 	pxtn_stream->tag_used(get_playback_position());
 }
 
+double AudioStreamPlaybackPxTone::get_render_ahead_latency() const {
+	return double(ring.size()) / sample_rate;
+}
+
 AudioStreamPlaybackPxTone::~AudioStreamPlaybackPxTone() {
-	delete svc;
+	if (!ring.is_empty() && PxToneRenderThread::get_singleton()) {
+		PxToneRenderThread::get_singleton()->remove_playback(this);
+	}
 }
 
 Ref<AudioStreamPlayback> AudioStreamPxTone::instantiate_playback() {
 	Ref<AudioStreamPlaybackPxTone> pxtns;
 
-	ERR_FAIL_COND_V_MSG(data.is_empty(), pxtns,
+	_update_song();
+	ERR_FAIL_COND_V_MSG(!song, pxtns,
 			"This AudioStreamPxTone does not have an audio file assigned "
 			"to it. AudioStreamPxTone should not be created from the "
 			"inspector or with `.new()`. Instead, load an audio file.");
 
 	pxtns.instantiate();
 	pxtns->pxtn_stream = Ref<AudioStreamPxTone>(this);
-	auto svc = new pxtnService();
-	pxtns->svc = svc;
+	pxtns->svc = song;
+	pxtns->seek_index = seek_index;
+	pxtns->sample_rate = sample_rate;
 
-	pxtnERR errorcode = svc->init();
-	if (errorcode != pxtnOK) {
-		ERR_FAIL_COND_V(errorcode, Ref<AudioStreamPlaybackPxTone>());
+	if (render_at_mix_rate) {
+		_update_native_song();
+		if (native_song) {
+			pxtns->svc = native_song;
+			pxtns->seek_index = native_seek_index;
+			pxtns->sample_rate = native_sample_rate;
+		}
 	}
 
-	svc->set_destination_quality(2, (int)sample_rate);
-
-	pxtnDescriptor desc;
-	desc.set_memory_r(data.ptr(), data.size());
-
-	errorcode = svc->read(&desc);
+	_update_loop_cache();
+	pxtns->loop_cache = pxtns->svc == song ? loop_cache : native_loop_cache;
 
-	if (errorcode != pxtnOK) {
-		ERR_FAIL_COND_V(errorcode, Ref<AudioStreamPlaybackPxTone>());
+	if (render_ahead) {
+		uint32_t ring_size = next_power_of_2(MAX(1024u, uint32_t(render_ahead_latency * pxtns->sample_rate)));
+		pxtns->ring.resize(ring_size);
+		pxtns->ring_mask = ring_size - 1;
 	}
 
 	pxtns->frames_mixed = 0;
@@ -170,50 +537,502 @@ String AudioStreamPxTone::get_stream_name() const {
 
 void AudioStreamPxTone::clear_data() {
 	data.clear();
+	compiled_woices.clear();
+	song.reset();
+	native_song.reset();
+	seek_index.reset();
+	native_seek_index.reset();
+	_drop_loop_cache(loop_cache);
+	_drop_loop_cache(native_loop_cache);
 }
 
-void AudioStreamPxTone::set_data(const Vector<uint8_t> &p_data) {
-	int src_data_len = p_data.size();
-	const uint8_t *src_datar = p_data.ptr();
+std::shared_ptr<PxToneSeekIndex> AudioStreamPxTone::_make_seek_index(float p_sample_rate) const {
+	std::shared_ptr<PxToneSeekIndex> index = std::make_shared<PxToneSeekIndex>();
+	index->interval = int32_t(seek_interval * p_sample_rate);
+	return index;
+}
+
+struct PxToneLoopCacheTask {
+	std::shared_ptr<const pxtnService> song;
+	std::shared_ptr<PxToneLoopCache> cache;
+	pxtnMOOLIMIT limit;
+};
+
+static void _pxtone_build_loop_cache(void *p_userdata) {
+	PxToneLoopCacheTask *task = (PxToneLoopCacheTask *)p_userdata;
+	if (task->cache->build(*task->song, task->limit)) {
+		task->cache->ready.set();
+	} else {
+		task->cache->frames.reset();
+	}
+	delete task;
+}
+
+std::shared_ptr<PxToneLoopCache> AudioStreamPxTone::_make_loop_cache(const std::shared_ptr<const pxtnService> &p_song) const {
+	// Unlimited output doesn't fit the 16-bit cache.
+	if (!p_song || limit_mode == LIMIT_MODE_NONE) {
+		return nullptr;
+	}
+
+	// The task holds its own references, like _ready_pending_woices.
+	std::shared_ptr<PxToneLoopCache> cache = std::make_shared<PxToneLoopCache>();
+	PxToneLoopCacheTask *task = new PxToneLoopCacheTask{ p_song, cache, _get_moo_limit(limit_mode) };
+	cache->task = WorkerThreadPool::get_singleton()->add_native_task(_pxtone_build_loop_cache, task, false, "PxTone loop cache");
+	return cache;
+}
+
+// Playbacks keep using a cache they already have, but a build still running is
+// stopped.
+void AudioStreamPxTone::_drop_loop_cache(std::shared_ptr<PxToneLoopCache> &r_cache) {
+	if (!r_cache) {
+		return;
+	}
+	r_cache->cancelled.set();
+	if (r_cache->task != WorkerThreadPool::INVALID_TASK_ID) {
+		WorkerThreadPool::get_singleton()->wait_for_task_completion(r_cache->task);
+	}
+	r_cache.reset();
+}
+
+void AudioStreamPxTone::_update_loop_cache() {
+	if (loop_cache_mode == LOOP_CACHE_MODE_DISABLED) {
+		_drop_loop_cache(loop_cache);
+		_drop_loop_cache(native_loop_cache);
+		return;
+	}
+	if (loop_cache_mode == LOOP_CACHE_MODE_ON_LOAD) {
+		_update_song();
+		_update_native_song();
+	}
+
+	if (song && !loop_cache) {
+		loop_cache = _make_loop_cache(song);
+	}
+	if (native_song && !native_loop_cache) {
+		native_loop_cache = _make_loop_cache(native_song);
+	}
+}
+
+// A song rendered to memory by render_to_wav() or render_to_frames().
+struct PxToneWavRender {
+	// Readied at mix_rate by render() if the stream had no such song yet.
+	std::shared_ptr<const pxtnService> song;
+	Vector<uint8_t> data;
+	Vector<uint8_t> woices;
+	AudioStreamPxTone::ResampleMode resample_mode = AudioStreamPxTone::RESAMPLE_MODE_SINC;
+	pxtnMOOLIMIT limit = pxtnMOOLIMIT_clamp;
+	int mix_rate = 0;
+	int loops = 0;
+
+	// Set when rendered in the background, to report to.
+	AudioStreamPxTone *stream = nullptr;
+	uint64_t id = 0;
+	Thread thread;
+	SafeFlag cancelled;
+	SafeNumeric<float> progress;
+	bool succeeded = false;
+
+	LocalVector<int16_t> frames; // Interleaved stereo.
+	int32_t frame_num = 0;
+	int32_t loop_begin = -1; // The last pass of the repeated part, if looped.
+
+	void _set_progress(float p_progress);
+	bool render();
+	Ref<AudioStreamWAV> make_wav() const;
+};
+
+void PxToneWavRender::_set_progress(float p_progress) {
+	int percent = int(p_progress * 100);
+	if (stream && percent != int(progress.get() * 100)) {
+		Callable(stream, SNAME("emit_signal")).call_deferred(SNAME("render_to_wav_progress"), percent / 100.0);
+	}
+	progress.set(p_progress);
+}
+
+bool PxToneWavRender::render() {
+	if (!song) {
+		song = AudioStreamPxTone::_compile_song(data, woices, mix_rate, resample_mode, false);
+		ERR_FAIL_COND_V(!song, false);
+	}
 
-	pxtnService svc;
 	mooState state;
+	_pxtone_prepare(*song, state);
+	state.params.b_loop = loops > 0;
+	int32_t song_end = song->moo_get_end_sample(state);
+	ERR_FAIL_COND_V(song_end <= 0, false);
+
+	// Until the song first jumps back, the repeated part's length isn't known.
+	int64_t total = song_end;
+	int32_t loop_length = 0;
+	// Moo_f32_Parallel splits each slice across the worker threads, so slices
+	// are long enough to keep them all busy.
+	const int32_t slice = MAX(mix_rate * PXTONE_RENDER_SLICE, 1);
+	LocalVector<float> scratch;
+	while (frame_num < total) {
+		int32_t count = int32_t(MIN(int64_t(slice), total - frame_num));
+		scratch.resize(uint32_t(count) * 2);
+		int filled_frames = 0;
+		bool ok = song->Moo_f32_Parallel(state, scratch.ptr(), count, &filled_frames, limit);
+		frames.resize(uint32_t(frame_num + filled_frames) * 2);
+		_pxtone_f32_to_s16(scratch.ptr(), frames.ptr() + size_t(frame_num) * 2, filled_frames * 2);
+		frame_num += filled_frames;
+		if (cancelled.is_set()) {
+			return false;
+		}
+		if (!ok || filled_frames < count) {
+			break;
+		}
+		if (loops > 0 && frame_num == song_end) {
+			loop_length = song_end - state.smp_count;
+			ERR_FAIL_COND_V(state.num_loop != 1 || loop_length <= 0, false);
+			total = song_end + int64_t(loops - 1) * loop_length;
+			ERR_FAIL_COND_V_MSG(total * 2 * sizeof(int16_t) > INT32_MAX, false, "Too many loops to render.");
+		}
+		_set_progress(float(double(frame_num) / double(total)));
+	}
+
+	frames.resize(uint32_t(frame_num) * 2);
+	if (loop_length > 0) {
+		loop_begin = frame_num - loop_length;
+	}
+	_set_progress(1.0);
+	return true;
+}
+
+Ref<AudioStreamWAV> PxToneWavRender::make_wav() const {
+	Vector<uint8_t> pcm;
+	pcm.resize(frame_num * 2 * sizeof(int16_t));
+	memcpy(pcm.ptrw(), frames.ptr(), pcm.size());
+
+	Ref<AudioStreamWAV> wav;
+	wav.instantiate();
+	wav->set_format(AudioStreamWAV::FORMAT_16_BITS);
+	wav->set_mix_rate(mix_rate);
+	wav->set_stereo(true);
+	wav->set_data(pcm);
+	if (loop_begin >= 0) {
+		wav->set_loop_mode(AudioStreamWAV::LOOP_FORWARD);
+		wav->set_loop_begin(loop_begin);
+		wav->set_loop_end(frame_num);
+	}
+	return wav;
+}
+
+std::shared_ptr<PxToneWavRender> AudioStreamPxTone::_make_wav_render(int p_mix_rate, int p_loops) {
+	ERR_FAIL_COND_V_MSG(data.is_empty(), nullptr, "This AudioStreamPxTone has no song to render.");
+	ERR_FAIL_COND_V(p_loops < 0, nullptr);
+	int mix_rate = p_mix_rate > 0 ? p_mix_rate : (int)sample_rate;
+	ERR_FAIL_COND_V(mix_rate < 1000 || mix_rate > 384000, nullptr);
+
+	std::shared_ptr<PxToneWavRender> job = std::make_shared<PxToneWavRender>();
+	// Playbacks' songs are reused if they're readied at that rate already.
+	if (song && mix_rate == (int)sample_rate) {
+		job->song = song;
+	} else if (native_song && mix_rate == (int)native_sample_rate) {
+		job->song = native_song;
+	}
+	job->data = data;
+	job->woices = compiled_woices;
+	job->resample_mode = resample_mode;
+	job->limit = _get_moo_limit(limit_mode);
+	job->mix_rate = mix_rate;
+	job->loops = p_loops;
+	return job;
+}
+
+void AudioStreamPxTone::_render_wav_task(void *p_userdata) {
+	PxToneWavRender *job = (PxToneWavRender *)p_userdata;
+	job->succeeded = job->render();
+	callable_mp(job->stream, &AudioStreamPxTone::_finish_render_to_wav).call_deferred(job->id);
+}
+
+void AudioStreamPxTone::_finish_render_to_wav(uint64_t p_id) {
+	// A render cancelled and replaced before this ran has been reported already.
+	if (!wav_render || wav_render->id != p_id) {
+		return;
+	}
+	std::shared_ptr<PxToneWavRender> job = wav_render;
+	wav_render.reset();
+	job->thread.wait_to_finish();
+
+	Ref<AudioStreamWAV> wav;
+	if (job->succeeded && !job->cancelled.is_set()) {
+		wav = job->make_wav();
+	}
+	emit_signal(SNAME("render_to_wav_finished"), wav);
+}
+
+Ref<AudioStreamWAV> AudioStreamPxTone::render_to_wav(int p_mix_rate, int p_loops, bool p_async) {
+	ERR_FAIL_COND_V_MSG(wav_render, Ref<AudioStreamWAV>(), "This AudioStreamPxTone is already rendering to WAV in the background.");
+	std::shared_ptr<PxToneWavRender> job = _make_wav_render(p_mix_rate, p_loops);
+	if (!job) {
+		return Ref<AudioStreamWAV>();
+	}
+
+	if (!p_async) {
+		return job->render() ? job->make_wav() : Ref<AudioStreamWAV>();
+	}
+
+	// The job stays alive in wav_render until its result is emitted, and the
+	// destructor waits for the thread. It's not a worker, so the render can
+	// still spread over the workers.
+	job->stream = this;
+	job->id = ++wav_render_id;
+	wav_render = job;
+	job->thread.start(_render_wav_task, job.get());
+	return Ref<AudioStreamWAV>();
+}
+
+PackedVector2Array AudioStreamPxTone::render_to_frames(int p_mix_rate, int p_loops) {
+	PackedVector2Array ret;
+	std::shared_ptr<PxToneWavRender> job = _make_wav_render(p_mix_rate, p_loops);
+	if (!job || !job->render()) {
+		return ret;
+	}
+
+	ret.resize(job->frame_num);
+	Vector2 *dst = ret.ptrw();
+	const int16_t *src = job->frames.ptr();
+	for (int32_t i = 0; i < job->frame_num; i++) {
+		dst[i] = Vector2(src[i * 2] / 32768.0f, src[i * 2 + 1] / 32768.0f);
+	}
+	return ret;
+}
+
+void AudioStreamPxTone::cancel_render_to_wav() {
+	if (!wav_render) {
+		return;
+	}
+	wav_render->cancelled.set();
+	_finish_render_to_wav(wav_render->id);
+}
+
+bool AudioStreamPxTone::is_rendering_to_wav() const {
+	return bool(wav_render);
+}
+
+float AudioStreamPxTone::get_render_to_wav_progress() const {
+	return wav_render ? wav_render->progress.get() : 0.0f;
+}
+
+struct PxToneTaskGroup {
+	pxtnTaskProc proc;
+	void *user;
+};
+
+static void _pxtone_group_task(void *p_userdata, uint32_t p_index) {
+	PxToneTaskGroup *group = (PxToneTaskGroup *)p_userdata;
+	group->proc(group->user, (int32_t)p_index);
+}
+
+// Lets pxtone ready woices and render offline on the engine's worker threads
+// instead of spawning its own.
+static void _pxtone_run_tasks(void *p_runner_user, pxtnTaskProc p_proc, void *p_user, int32_t p_task_num) {
+	if (p_task_num <= 0) {
+		return;
+	}
+	// Already on a worker, e.g. a threaded import: the other workers are busy
+	// with songs of their own, and waiting on them could leave none to run the
+	// group.
+	if (WorkerThreadPool::get_singleton()->get_thread_index() != -1) {
+		for (int32_t i = 0; i < p_task_num; i++) {
+			p_proc(p_user, i);
+		}
+		return;
+	}
+	PxToneTaskGroup group = { p_proc, p_user };
+	WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+	WorkerThreadPool::GroupID group_id = pool->add_native_group_task(_pxtone_group_task, &group, p_task_num, -1, true, "PxTone tasks");
+	pool->wait_for_group_task_completion(group_id);
+}
+
+std::shared_ptr<pxtnService> AudioStreamPxTone::_compile_song(const Vector<uint8_t> &p_data, const Vector<uint8_t> &p_woices, int p_sample_rate, ResampleMode p_resample, bool p_lazy) {
+	std::shared_ptr<pxtnService> svc = std::make_shared<pxtnService>();
 	pxtnDescriptor desc;
 
-	channels = 2;
-	sample_rate = 44100;
+	ERR_FAIL_COND_V_MSG(svc->init() != pxtnOK, nullptr, "Failed to initialize PxTone service.");
+	svc->set_destination_quality(2, p_sample_rate);
+	svc->set_task_runner(_pxtone_run_tasks, nullptr);
+	svc->set_resample(p_resample == RESAMPLE_MODE_SINC ? pxtnRESAMPLE_sinc : pxtnRESAMPLE_nearest);
+	svc->set_lazy_tones(p_lazy, PXTONE_LAZY_WOICE_LEAD);
+
+	desc.set_memory_r(p_data.ptr(), p_data.size());
+	ERR_FAIL_COND_V_MSG(svc->read(&desc) != pxtnOK, nullptr, "Failed to decode specified PxTone file.");
+
+	// Woices compiled at another rate or resample mode don't match, and are
+	// readied from the song like any other.
+	if (!p_woices.is_empty()) {
+		pxtnDescriptor woices_desc;
+		woices_desc.set_memory_r(p_woices.ptr(), p_woices.size());
+		if (svc->tones_read(&woices_desc) == pxtnOK) {
+			return svc;
+		}
+	}
+	ERR_FAIL_COND_V(svc->tones_ready() != pxtnOK, nullptr);
+
+	return svc;
+}
+
+static void _pxtone_ready_pending_woices(void *p_userdata) {
+	std::shared_ptr<const pxtnService> *song = (std::shared_ptr<const pxtnService> *)p_userdata;
+	(*song)->tones_ready_pending();
+	delete song;
+}
+
+void AudioStreamPxTone::_ready_pending_woices(const std::shared_ptr<const pxtnService> &p_song) {
+	if (!lazy_woices || !p_song) {
+		return;
+	}
+	_wait_pending_woices();
+
+	// The task holds its own reference, so the song outlives it even if the stream drops it.
+	pending_woices_task = WorkerThreadPool::get_singleton()->add_native_task(_pxtone_ready_pending_woices, new std::shared_ptr<const pxtnService>(p_song), false, "PxTone pending woices");
+}
+
+void AudioStreamPxTone::_wait_pending_woices() {
+	if (pending_woices_task == WorkerThreadPool::INVALID_TASK_ID) {
+		return;
+	}
+	WorkerThreadPool::get_singleton()->wait_for_task_completion(pending_woices_task);
+	pending_woices_task = WorkerThreadPool::INVALID_TASK_ID;
+}
+
+void AudioStreamPxTone::_update_native_song() {
+	if (!render_at_mix_rate || !song) {
+		native_song.reset();
+		native_seek_index.reset();
+		_drop_loop_cache(native_loop_cache);
+		return;
+	}
 
-	desc.set_memory_r(data.ptr(), data.size());
+	int mix_rate = (int)AudioServer::get_singleton()->get_mix_rate();
+	if (mix_rate == (int)sample_rate) {
+		native_song.reset();
+		native_seek_index.reset();
+		_drop_loop_cache(native_loop_cache);
+		native_sample_rate = sample_rate;
+		return;
+	}
+	if (native_song && (int)native_sample_rate == mix_rate) {
+		return;
+	}
 
-	ERR_FAIL_COND_MSG(svc.init() != pxtnOK, "Failed to initialize PxTone service.");
-	svc.set_destination_quality(channels, (int)sample_rate);
+	// Envelopes and delays depend on the output rate, so the song is readied again for it.
+	_drop_loop_cache(native_loop_cache);
+	native_song = _compile_song(data, compiled_woices, mix_rate, resample_mode, lazy_woices);
+	native_sample_rate = mix_rate;
+	_ready_pending_woices(native_song);
+	native_seek_index = _make_seek_index(native_sample_rate);
+}
 
+bool AudioStreamPxTone::_read_song_info(const Vector<uint8_t> &p_data) {
+	pxtnService svc;
+	pxtnDescriptor desc;
+
+	ERR_FAIL_COND_V_MSG(svc.init() != pxtnOK, false, "Failed to initialize PxTone service.");
+
+	// Only the master and events are read, no woice is decoded.
 	desc.set_memory_r(p_data.ptr(), p_data.size());
-	ERR_FAIL_COND_MSG(svc.read(&desc) != pxtnOK, "Failed to decode specified PxTone file.");
-	ERR_FAIL_COND(svc.tones_ready(state) != pxtnOK);
+	ERR_FAIL_COND_V_MSG(svc.read_meta(&desc) != pxtnOK, false, "Failed to decode specified PxTone file.");
 
-	pxtnVOMITPREPARATION prep;
-	memset(&prep, 0, sizeof(prep));
-	prep.master_volume = 1.0f;
-	prep.flags = pxtnVOMITPREPFLAG_loop;
-	prep.start_pos_float = 0.0f;
-	svc.moo_preparation(&prep, state);
-	length = svc.moo_get_total_sample() / sample_rate;
-	bpm = (double)svc.master->get_beat_tempo();
+	int32_t beat_num = 0;
+	int32_t meas_num = 0;
+	float beat_tempo = 0;
+	svc.master->Get(&beat_num, &beat_tempo, nullptr, &meas_num);
+
+	length = pxtnService_moo_CalcSampleNum(meas_num, beat_num, (int32_t)sample_rate, beat_tempo) / sample_rate;
+	bpm = (double)beat_tempo;
+	beat_count = beat_num;
+	return true;
+}
+
+void AudioStreamPxTone::_update_song() {
+	if (song || data.is_empty()) {
+		return;
+	}
+
+	// Readying the woices is the slow part of loading a song, so it waits until
+	// the song is actually played.
+	song = _compile_song(data, compiled_woices, (int)sample_rate, resample_mode, lazy_woices);
+	if (song) {
+		seek_index = _make_seek_index(sample_rate);
+		_ready_pending_woices(song);
+	}
+}
+
+void AudioStreamPxTone::set_data(const Vector<uint8_t> &p_data) {
+	int src_data_len = p_data.size();
+	const uint8_t *src_datar = p_data.ptr();
+
+	channels = 2;
+	sample_rate = 44100;
 	bar_beats = 1;
-	beat_count = svc.master->get_beat_num();
 
+	// Saved resources store song_info right before the data, so loading them
+	// doesn't scan the song again.
+	if (!song_info_pending) {
+		ERR_FAIL_COND(!_read_song_info(p_data));
+	}
+	song_info_pending = false;
+
+	// Playbacks that are already running keep the previous song alive through
+	// their own reference.
 	clear_data();
 
 	data.resize(src_data_len);
 	memcpy(data.ptrw(), src_datar, src_data_len);
 	data_len = src_data_len;
+
+	if (loop_cache_mode == LOOP_CACHE_MODE_ON_LOAD) {
+		_update_loop_cache();
+	}
 }
 
 Vector<uint8_t> AudioStreamPxTone::get_data() const {
 	return data;
 }
 
+void AudioStreamPxTone::set_compiled_woices(const Vector<uint8_t> &p_woices) {
+	compiled_woices = p_woices;
+}
+
+Vector<uint8_t> AudioStreamPxTone::get_compiled_woices() const {
+	return compiled_woices;
+}
+
+Error AudioStreamPxTone::compile_woices() {
+	ERR_FAIL_COND_V(data.is_empty(), ERR_UNCONFIGURED);
+
+	_update_song();
+	ERR_FAIL_COND_V(!song, ERR_FILE_CORRUPT);
+
+	// Woices a lazily readied song left out are readied by tones_write.
+	std::vector<uint8_t> woices;
+	pxtnDescriptor desc;
+	desc.set_memory_w(&woices);
+	ERR_FAIL_COND_V(song->tones_write(&desc) != pxtnOK, ERR_CANT_CREATE);
+
+	compiled_woices.resize(woices.size());
+	memcpy(compiled_woices.ptrw(), woices.data(), woices.size());
+	return OK;
+}
+
+void AudioStreamPxTone::_set_song_info(const PackedFloat64Array &p_info) {
+	ERR_FAIL_COND(p_info.size() != 3);
+	length = p_info[0];
+	bpm = p_info[1];
+	beat_count = (int)p_info[2];
+	song_info_pending = true;
+}
+
+PackedFloat64Array AudioStreamPxTone::_get_song_info() const {
+	PackedFloat64Array info;
+	info.push_back(length);
+	info.push_back(bpm);
+	info.push_back(beat_count);
+	return info;
+}
+
 void AudioStreamPxTone::set_loop(bool p_enable) {
 	loop = p_enable;
 }
@@ -230,6 +1049,145 @@ double AudioStreamPxTone::get_loop_offset() const {
 	return loop_offset;
 }
 
+void AudioStreamPxTone::set_seek_interval(float p_seconds) {
+	seek_interval = MAX(p_seconds, 0.0f);
+
+	// Snapshots taken at the old interval can't be reused.
+	if (song) {
+		seek_index = _make_seek_index(sample_rate);
+	}
+	if (native_song) {
+		native_seek_index = _make_seek_index(native_sample_rate);
+	}
+}
+
+float AudioStreamPxTone::get_seek_interval() const {
+	return seek_interval;
+}
+
+void AudioStreamPxTone::set_render_at_mix_rate(bool p_enable) {
+	render_at_mix_rate = p_enable;
+	_update_native_song();
+	if (loop_cache_mode == LOOP_CACHE_MODE_ON_LOAD) {
+		_update_loop_cache();
+	}
+}
+
+bool AudioStreamPxTone::is_rendering_at_mix_rate() const {
+	return render_at_mix_rate;
+}
+
+void AudioStreamPxTone::set_render_ahead(bool p_enable) {
+	render_ahead = p_enable;
+}
+
+bool AudioStreamPxTone::is_rendering_ahead() const {
+	return render_ahead;
+}
+
+void AudioStreamPxTone::set_render_ahead_latency(float p_seconds) {
+	render_ahead_latency = CLAMP(p_seconds, 0.01f, 2.0f);
+}
+
+float AudioStreamPxTone::get_render_ahead_latency() const {
+	return render_ahead_latency;
+}
+
+int64_t AudioStreamPxTone::get_render_ahead_underruns() const {
+	return render_ahead_underruns.get();
+}
+
+void AudioStreamPxTone::reset_render_ahead_underruns() {
+	render_ahead_underruns.set(0);
+}
+
+void AudioStreamPxTone::set_woice_cache_budget(int64_t p_bytes) {
+	pxtnWoiceCache_set_budget(p_bytes);
+}
+
+int64_t AudioStreamPxTone::get_woice_cache_budget() {
+	return pxtnWoiceCache_get_budget();
+}
+
+Dictionary AudioStreamPxTone::get_woice_cache_stats() {
+	pxtnWOICECACHESTATS stats;
+	pxtnWoiceCache_get_stats(&stats);
+
+	Dictionary ret;
+	ret["entries"] = stats.entry_num;
+	ret["entries_in_use"] = stats.used_entry_num;
+	ret["bytes"] = stats.bytes;
+	ret["bytes_in_use"] = stats.used_bytes;
+	ret["bytes_shared"] = stats.shared_bytes;
+	ret["hits"] = stats.hit_num;
+	ret["misses"] = stats.miss_num;
+	return ret;
+}
+
+void AudioStreamPxTone::clear_woice_cache() {
+	pxtnWoiceCache_Purge();
+}
+
+void AudioStreamPxTone::set_limit_mode(LimitMode p_mode) {
+	if (limit_mode == p_mode) {
+		return;
+	}
+	limit_mode = p_mode;
+
+	// The loop cache is rendered with the limit mode, so it's rendered again on
+	// next use. Playbacks already served by it keep it.
+	_drop_loop_cache(loop_cache);
+	_drop_loop_cache(native_loop_cache);
+}
+
+AudioStreamPxTone::LimitMode AudioStreamPxTone::get_limit_mode() const {
+	return limit_mode;
+}
+
+void AudioStreamPxTone::set_resample_mode(ResampleMode p_mode) {
+	if (resample_mode == p_mode) {
+		return;
+	}
+	resample_mode = p_mode;
+
+	// Samples are converted when the song is readied, so it's readied again on
+	// next use. Running playbacks keep the song they started with.
+	song.reset();
+	native_song.reset();
+	seek_index.reset();
+	native_seek_index.reset();
+	_drop_loop_cache(loop_cache);
+	_drop_loop_cache(native_loop_cache);
+}
+
+AudioStreamPxTone::ResampleMode AudioStreamPxTone::get_resample_mode() const {
+	return resample_mode;
+}
+
+void AudioStreamPxTone::set_lazy_woices(bool p_enable) {
+	lazy_woices = p_enable;
+}
+
+bool AudioStreamPxTone::is_loading_woices_lazily() const {
+	return lazy_woices;
+}
+
+void AudioStreamPxTone::set_loop_cache_mode(LoopCacheMode p_mode) {
+	loop_cache_mode = p_mode;
+	if (loop_cache_mode != LOOP_CACHE_MODE_ON_PLAY) {
+		_update_loop_cache();
+	}
+}
+
+AudioStreamPxTone::LoopCacheMode AudioStreamPxTone::get_loop_cache_mode() const {
+	return loop_cache_mode;
+}
+
+bool AudioStreamPxTone::is_loop_cache_ready() const {
+	const std::shared_ptr<PxToneLoopCache> &cache = native_song ? native_loop_cache : loop_cache;
+	return cache && cache->ready.is_set();
+}
+
 double AudioStreamPxTone::get_length() const {
 	return length;
 }
@@ -255,27 +1213,105 @@ void AudioStreamPxTone::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_data", "data"), &AudioStreamPxTone::set_data);
 	ClassDB::bind_method(D_METHOD("get_data"), &AudioStreamPxTone::get_data);
 
+	ClassDB::bind_method(D_METHOD("set_compiled_woices", "woices"), &AudioStreamPxTone::set_compiled_woices);
+	ClassDB::bind_method(D_METHOD("get_compiled_woices"), &AudioStreamPxTone::get_compiled_woices);
+	ClassDB::bind_method(D_METHOD("compile_woices"), &AudioStreamPxTone::compile_woices);
+
+	ClassDB::bind_method(D_METHOD("_set_song_info", "info"), &AudioStreamPxTone::_set_song_info);
+	ClassDB::bind_method(D_METHOD("_get_song_info"), &AudioStreamPxTone::_get_song_info);
+
 	ClassDB::bind_method(D_METHOD("set_loop", "enable"), &AudioStreamPxTone::set_loop);
 	ClassDB::bind_method(D_METHOD("has_loop"), &AudioStreamPxTone::has_loop);
 
 	ClassDB::bind_method(D_METHOD("set_loop_offset", "seconds"), &AudioStreamPxTone::set_loop_offset);
 	ClassDB::bind_method(D_METHOD("get_loop_offset"), &AudioStreamPxTone::get_loop_offset);
 
+	ClassDB::bind_method(D_METHOD("set_seek_interval", "seconds"), &AudioStreamPxTone::set_seek_interval);
+	ClassDB::bind_method(D_METHOD("get_seek_interval"), &AudioStreamPxTone::get_seek_interval);
+
+	ClassDB::bind_method(D_METHOD("set_render_at_mix_rate", "enable"), &AudioStreamPxTone::set_render_at_mix_rate);
+	ClassDB::bind_method(D_METHOD("is_rendering_at_mix_rate"), &AudioStreamPxTone::is_rendering_at_mix_rate);
+
+	ClassDB::bind_method(D_METHOD("set_render_ahead", "enable"), &AudioStreamPxTone::set_render_ahead);
+	ClassDB::bind_method(D_METHOD("is_rendering_ahead"), &AudioStreamPxTone::is_rendering_ahead);
+
+	ClassDB::bind_method(D_METHOD("set_render_ahead_latency", "seconds"), &AudioStreamPxTone::set_render_ahead_latency);
+	ClassDB::bind_method(D_METHOD("get_render_ahead_latency"), &AudioStreamPxTone::get_render_ahead_latency);
+
+	ClassDB::bind_method(D_METHOD("get_render_ahead_underruns"), &AudioStreamPxTone::get_render_ahead_underruns);
+	ClassDB::bind_method(D_METHOD("reset_render_ahead_underruns"), &AudioStreamPxTone::reset_render_ahead_underruns);
+
+	ClassDB::bind_static_method("AudioStreamPxTone", D_METHOD("set_woice_cache_budget", "bytes"), &AudioStreamPxTone::set_woice_cache_budget);
+	ClassDB::bind_static_method("AudioStreamPxTone", D_METHOD("get_woice_cache_budget"), &AudioStreamPxTone::get_woice_cache_budget);
+	ClassDB::bind_static_method("AudioStreamPxTone", D_METHOD("get_woice_cache_stats"), &AudioStreamPxTone::get_woice_cache_stats);
+	ClassDB::bind_static_method("AudioStreamPxTone", D_METHOD("clear_woice_cache"), &AudioStreamPxTone::clear_woice_cache);
+
+	ClassDB::bind_method(D_METHOD("set_limit_mode", "mode"), &AudioStreamPxTone::set_limit_mode);
+	ClassDB::bind_method(D_METHOD("get_limit_mode"), &AudioStreamPxTone::get_limit_mode);
+
+	ClassDB::bind_method(D_METHOD("set_resample_mode", "mode"), &AudioStreamPxTone::set_resample_mode);
+	ClassDB::bind_method(D_METHOD("get_resample_mode"), &AudioStreamPxTone::get_resample_mode);
+
+	ClassDB::bind_method(D_METHOD("set_lazy_woices", "enable"), &AudioStreamPxTone::set_lazy_woices);
+	ClassDB::bind_method(D_METHOD("is_loading_woices_lazily"), &AudioStreamPxTone::is_loading_woices_lazily);
+
+	ClassDB::bind_method(D_METHOD("set_loop_cache_mode", "mode"), &AudioStreamPxTone::set_loop_cache_mode);
+	ClassDB::bind_method(D_METHOD("get_loop_cache_mode"), &AudioStreamPxTone::get_loop_cache_mode);
+	ClassDB::bind_method(D_METHOD("is_loop_cache_ready"), &AudioStreamPxTone::is_loop_cache_ready);
+
+	ClassDB::bind_method(D_METHOD("render_to_wav", "mix_rate", "loops", "async"), &AudioStreamPxTone::render_to_wav, DEFVAL(0), DEFVAL(1), DEFVAL(false));
+	ClassDB::bind_method(D_METHOD("render_to_frames", "mix_rate", "loops"), &AudioStreamPxTone::render_to_frames, DEFVAL(0), DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("cancel_render_to_wav"), &AudioStreamPxTone::cancel_render_to_wav);
+	ClassDB::bind_method(D_METHOD("is_rendering_to_wav"), &AudioStreamPxTone::is_rendering_to_wav);
+	ClassDB::bind_method(D_METHOD("get_render_to_wav_progress"), &AudioStreamPxTone::get_render_to_wav_progress);
+
 	ClassDB::bind_method(D_METHOD("get_bpm"), &AudioStreamPxTone::get_bpm);
 	ClassDB::bind_method(D_METHOD("get_beat_count"), &AudioStreamPxTone::get_beat_count);
 	ClassDB::bind_method(D_METHOD("get_bar_beats"), &AudioStreamPxTone::get_bar_beats);
 
+	// Length, bpm and beat count, stored ahead of data so they're loaded first.
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT64_ARRAY, "song_info", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_STORAGE | PROPERTY_USAGE_INTERNAL), "_set_song_info", "_get_song_info");
 	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "data", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NO_EDITOR), "set_data", "get_data");
+	// After data, which clears it.
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "compiled_woices", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NO_EDITOR), "set_compiled_woices", "get_compiled_woices");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "bpm", PROPERTY_HINT_RANGE, "0,400,0.01,or_greater"), "", "get_bpm");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "beat_count", PROPERTY_HINT_RANGE, "0,512,1,or_greater"), "", "get_beat_count");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "bar_beats", PROPERTY_HINT_RANGE, "2,32,1,or_greater"), "", "get_bar_beats");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "loop"), "set_loop", "has_loop");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "loop_offset"), "set_loop_offset", "get_loop_offset");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lazy_woices"), "set_lazy_woices", "is_loading_woices_lazily");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "seek_interval", PROPERTY_HINT_RANGE, "0,60,0.1,or_greater,suffix:s"), "set_seek_interval", "get_seek_interval");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "render_at_mix_rate"), "set_render_at_mix_rate", "is_rendering_at_mix_rate");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "render_ahead"), "set_render_ahead", "is_rendering_ahead");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "render_ahead_latency", PROPERTY_HINT_RANGE, "0.01,2,0.01,suffix:s"), "set_render_ahead_latency", "get_render_ahead_latency");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "limit_mode", PROPERTY_HINT_ENUM, "Clamp,Soft,None"), "set_limit_mode", "get_limit_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "resample_mode", PROPERTY_HINT_ENUM, "Nearest,Sinc"), "set_resample_mode", "get_resample_mode");
+	// Last, so that loading a resource only renders the cache once everything else is set.
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "loop_cache_mode", PROPERTY_HINT_ENUM, "Disabled,On Play,On Load"), "set_loop_cache_mode", "get_loop_cache_mode");
+
+	ADD_SIGNAL(MethodInfo("render_to_wav_progress", PropertyInfo(Variant::FLOAT, "progress")));
+	ADD_SIGNAL(MethodInfo("render_to_wav_finished", PropertyInfo(Variant::OBJECT, "stream", PROPERTY_HINT_RESOURCE_TYPE, "AudioStreamWAV")));
+
+	BIND_ENUM_CONSTANT(LIMIT_MODE_CLAMP);
+	BIND_ENUM_CONSTANT(LIMIT_MODE_SOFT);
+	BIND_ENUM_CONSTANT(LIMIT_MODE_NONE);
+
+	BIND_ENUM_CONSTANT(RESAMPLE_MODE_NEAREST);
+	BIND_ENUM_CONSTANT(RESAMPLE_MODE_SINC);
+
+	BIND_ENUM_CONSTANT(LOOP_CACHE_MODE_DISABLED);
+	BIND_ENUM_CONSTANT(LOOP_CACHE_MODE_ON_PLAY);
+	BIND_ENUM_CONSTANT(LOOP_CACHE_MODE_ON_LOAD);
 }
 
 AudioStreamPxTone::AudioStreamPxTone() {
 }
 
 AudioStreamPxTone::~AudioStreamPxTone() {
+	if (wav_render) {
+		wav_render->cancelled.set();
+		wav_render->thread.wait_to_finish();
+	}
+	_wait_pending_woices();
 	clear_data();
 }
@@ -29,30 +29,104 @@
 #define AUDIO_STREAM_PXTONE_H
 
 #include "core/io/resource_loader.h"
+#include "core/object/worker_thread_pool.h"
+#include "core/os/mutex.h"
+#include "core/templates/local_vector.h"
+#include "core/templates/safe_refcount.h"
+#include "scene/resources/audio_stream_wav.h"
 #include "servers/audio/audio_stream.h"
 
 #include "pxtone/pxtnService.h"
 
 class AudioStreamPxTone;
+struct PxToneWavRender;
+
+// Playback states taken every seek_interval seconds of a song, shared by its
+// playbacks. Seeking copies the closest one and renders from there instead of
+// from the start of the song.
+struct PxToneSeekIndex {
+	Mutex mutex;
+	int32_t interval = 0; // In samples, 0 disables the snapshots.
+	std::vector<mooState> snapshots; // snapshots[i] is the state at sample i * interval.
+};
+
+// A song rendered once as 16-bit stereo: the intro and the first loops, up to
+// where the delay tails carried into each loop have settled, and then one loop
+// body that repeats exactly from there on. Built in the background and shared
+// by the playbacks of a song, which only copy from it once it's ready.
+struct PxToneLoopCache {
+	SafeFlag ready;
+	SafeFlag cancelled;
+	WorkerThreadPool::TaskID task = WorkerThreadPool::INVALID_TASK_ID;
+	LocalVector<int16_t> frames; // Interleaved stereo.
+	int32_t frame_num = 0;
+	int32_t song_end = 0; // Where the song reaches its end for the first time.
+	int32_t loop_length = 0;
+	int32_t loop_start = 0; // Start of the body repeated from the end of frames.
+
+	bool _render(const pxtnService &p_svc, mooState &r_state, int32_t p_frames, pxtnMOOLIMIT p_limit);
+
+	bool build(const pxtnService &p_svc, pxtnMOOLIMIT p_limit);
+	// Position in frames that a live state starting from the song's start is at.
+	int32_t get_position(const mooState &p_state) const;
+	// Sample of the song that [p_pos] in frames plays.
+	int32_t get_song_sample(int32_t p_pos) const;
+};
 
 class AudioStreamPlaybackPxTone : public AudioStreamPlaybackResampled {
 	GDCLASS(AudioStreamPlaybackPxTone, AudioStreamPlaybackResampled);
 
-	pxtnService *svc = nullptr;
+	// Shared with the stream and every other playback of it; only the mooState
+	// below is owned by this playback.
+	std::shared_ptr<const pxtnService> svc;
+	std::shared_ptr<PxToneSeekIndex> seek_index;
+	std::shared_ptr<PxToneLoopCache> loop_cache;
 	mooState state{};
+	// Position in loop_cache while it serves this playback, -1 while state is
+	// synthesized live.
+	int32_t cache_pos = -1;
+	float sample_rate = 1.0;
 	uint32_t frames_mixed = 0;
 	bool active = false;
+	bool mixing_direct = true;
 	int loops = 0;
 
+	// Render-ahead: PxToneRenderThread fills the ring with Moo_f32 and the mix
+	// only copies frames out of it. The positions only ever increase, the
+	// render thread owns ring_write and the mix owns ring_read.
+	LocalVector<AudioFrame> ring;
+	uint32_t ring_mask = 0;
+	SafeNumeric<uint32_t> ring_read;
+	SafeNumeric<uint32_t> ring_write;
+	// Set by start() and seek(): frames before flush_pos belong to the old position.
+	SafeNumeric<uint32_t> flush_pos;
+	SafeNumeric<uint32_t> flush_generation;
+	uint32_t flush_generation_seen = 0;
+	SafeFlag render_ended;
+	// Held while state is rendered or repositioned.
+	Mutex render_mutex;
+
 	friend class AudioStreamPxTone;
+	friend class PxToneRenderThread;
 
 	Ref<AudioStreamPxTone> pxtn_stream;
 
+	void _prepare(mooState &r_state) const;
+	void _seek(double p_time, mooState &r_state) const;
+	int32_t _get_seek_sample(double p_time) const;
+	bool _render(float *p_buffer, int p_frames, int *r_filled);
+	bool _render_cache(float *p_buffer, int p_frames, int *r_filled);
+	void _flush_ring();
+	void _render_ahead();
+	int _mix_ring(AudioFrame *p_buffer, int p_frames);
+
 protected:
 	virtual int _mix_internal(AudioFrame *p_buffer, int p_frames) override;
 	virtual float get_stream_sampling_rate() override;
 
 public:
+	virtual int mix(AudioFrame *p_buffer, float p_rate_scale, int p_frames) override;
+
 	virtual void start(double p_from_pos = 0.0) override;
 	virtual void stop() override;
 	virtual bool is_playing() const override;
@@ -64,6 +138,8 @@ public:
 
 	virtual void tag_used_streams() override;
 
+	double get_render_ahead_latency() const;
+
 	AudioStreamPlaybackPxTone() {}
 	~AudioStreamPlaybackPxTone();
 };
@@ -74,9 +150,43 @@ class AudioStreamPxTone : public AudioStream {
 	RES_BASE_EXTENSION("ptstr");
 
 	friend class AudioStreamPlaybackPxTone;
+	friend struct PxToneWavRender;
+
+public:
+	enum LimitMode {
+		LIMIT_MODE_CLAMP,
+		LIMIT_MODE_SOFT,
+		LIMIT_MODE_NONE,
+	};
+
+	enum ResampleMode {
+		RESAMPLE_MODE_NEAREST,
+		RESAMPLE_MODE_SINC,
+	};
+
+	enum LoopCacheMode {
+		LOOP_CACHE_MODE_DISABLED,
+		LOOP_CACHE_MODE_ON_PLAY,
+		LOOP_CACHE_MODE_ON_LOAD,
+	};
+
+private:
 
 	PackedByteArray data;
 	uint32_t data_len = 0;
+	// Woices readied at import, see compile_woices().
+	PackedByteArray compiled_woices;
+
+	// Parsed song with ready woices, built by the first playback and shared
+	// read-only by all of them.
+	std::shared_ptr<const pxtnService> song;
+	// Same song readied at the AudioServer mix rate, for render_at_mix_rate.
+	std::shared_ptr<const pxtnService> native_song;
+	float native_sample_rate = 0.0;
+	std::shared_ptr<PxToneSeekIndex> seek_index;
+	std::shared_ptr<PxToneSeekIndex> native_seek_index;
+	std::shared_ptr<PxToneLoopCache> loop_cache;
+	std::shared_ptr<PxToneLoopCache> native_loop_cache;
 
 	float sample_rate = 1.0;
 	float length = 0.0;
@@ -86,8 +196,37 @@ class AudioStreamPxTone : public AudioStream {
 	int beat_count = 0;
 	int bar_beats = 4;
 	bool loop = false;
+	LimitMode limit_mode = LIMIT_MODE_CLAMP;
+	ResampleMode resample_mode = RESAMPLE_MODE_SINC;
+	bool lazy_woices = false;
+	LoopCacheMode loop_cache_mode = LOOP_CACHE_MODE_DISABLED;
+	// Readies the woices a lazily compiled song left out.
+	WorkerThreadPool::TaskID pending_woices_task = WorkerThreadPool::INVALID_TASK_ID;
+	bool render_at_mix_rate = false;
+	float seek_interval = 10.0;
+	bool render_ahead = false;
+	float render_ahead_latency = 0.1;
+	SafeNumeric<uint64_t> render_ahead_underruns;
+	// Set when song_info has been loaded, so set_data() doesn't have to scan the song.
+	bool song_info_pending = false;
+	// render_to_wav() running in the background, until render_to_wav_finished is emitted.
+	std::shared_ptr<PxToneWavRender> wav_render;
+	uint64_t wav_render_id = 0;
 
 	void clear_data();
+	bool _read_song_info(const Vector<uint8_t> &p_data);
+	void _update_song();
+	static std::shared_ptr<pxtnService> _compile_song(const Vector<uint8_t> &p_data, const Vector<uint8_t> &p_woices, int p_sample_rate, ResampleMode p_resample, bool p_lazy);
+	void _ready_pending_woices(const std::shared_ptr<const pxtnService> &p_song);
+	void _wait_pending_woices();
+	void _update_native_song();
+	std::shared_ptr<PxToneSeekIndex> _make_seek_index(float p_sample_rate) const;
+	void _update_loop_cache();
+	std::shared_ptr<PxToneLoopCache> _make_loop_cache(const std::shared_ptr<const pxtnService> &p_song) const;
+	static void _drop_loop_cache(std::shared_ptr<PxToneLoopCache> &r_cache);
+	std::shared_ptr<PxToneWavRender> _make_wav_render(int p_mix_rate, int p_loops);
+	static void _render_wav_task(void *p_userdata);
+	void _finish_render_to_wav(uint64_t p_id);
 
 protected:
 	static void _bind_methods();
@@ -99,6 +238,45 @@ public:
 	void set_loop_offset(double p_seconds);
 	double get_loop_offset() const;
 
+	void set_seek_interval(float p_seconds);
+	float get_seek_interval() const;
+
+	void set_render_at_mix_rate(bool p_enable);
+	bool is_rendering_at_mix_rate() const;
+
+	void set_render_ahead(bool p_enable);
+	bool is_rendering_ahead() const;
+
+	void set_render_ahead_latency(float p_seconds);
+	float get_render_ahead_latency() const;
+
+	int64_t get_render_ahead_underruns() const;
+	void reset_render_ahead_underruns();
+
+	static void set_woice_cache_budget(int64_t p_bytes);
+	static int64_t get_woice_cache_budget();
+	static Dictionary get_woice_cache_stats();
+	static void clear_woice_cache();
+
+	void set_limit_mode(LimitMode p_mode);
+	LimitMode get_limit_mode() const;
+
+	void set_resample_mode(ResampleMode p_mode);
+	ResampleMode get_resample_mode() const;
+
+	void set_lazy_woices(bool p_enable);
+	bool is_loading_woices_lazily() const;
+
+	void set_loop_cache_mode(LoopCacheMode p_mode);
+	LoopCacheMode get_loop_cache_mode() const;
+	bool is_loop_cache_ready() const;
+
+	Ref<AudioStreamWAV> render_to_wav(int p_mix_rate = 0, int p_loops = 1, bool p_async = false);
+	PackedVector2Array render_to_frames(int p_mix_rate = 0, int p_loops = 0);
+	void cancel_render_to_wav();
+	bool is_rendering_to_wav() const;
+	float get_render_to_wav_progress() const;
+
 	virtual double get_bpm() const override;
 	virtual int get_beat_count() const override;
 	virtual int get_bar_beats() const override;
@@ -109,6 +287,13 @@ public:
 	void set_data(const Vector<uint8_t> &p_data);
 	Vector<uint8_t> get_data() const;
 
+	void set_compiled_woices(const Vector<uint8_t> &p_woices);
+	Vector<uint8_t> get_compiled_woices() const;
+	Error compile_woices();
+
+	void _set_song_info(const PackedFloat64Array &p_info);
+	PackedFloat64Array _get_song_info() const;
+
 	virtual double get_length() const override;
 
 	virtual bool is_monophonic() const override;
@@ -117,4 +302,8 @@ public:
 	virtual ~AudioStreamPxTone();
 };
 
+VARIANT_ENUM_CAST(AudioStreamPxTone::LimitMode);
+VARIANT_ENUM_CAST(AudioStreamPxTone::ResampleMode);
+VARIANT_ENUM_CAST(AudioStreamPxTone::LoopCacheMode);
+
 #endif // AUDIO_STREAM_PXTONE_H
@@ -67,6 +67,27 @@ pxtnDelayTone::pxtnDelayTone(const pxtnDelay &delay, int32_t beat_num,
   }
 }
 
+pxtnDelayTone::pxtnDelayTone(const pxtnDelayTone &src) {
+  _smp_num = 0;
+  *this = src;
+}
+
+pxtnDelayTone &pxtnDelayTone::operator=(const pxtnDelayTone &src) {
+  if (this == &src) return *this;
+  if (_smp_num != src._smp_num) {
+    for (int32_t c = 0; c < pxtnMAX_CHANNEL; c++)
+      _bufs[c] = src._smp_num ? std::make_unique<int32_t[]>(src._smp_num)
+                              : nullptr;
+  }
+  _smp_num = src._smp_num;
+  _offset = src._offset;
+  _rate_s32 = src._rate_s32;
+  for (int32_t c = 0; c < pxtnMAX_CHANNEL; c++)
+    if (_smp_num)
+      memcpy(_bufs[c].get(), src._bufs[c].get(), _smp_num * sizeof(int32_t));
+  return *this;
+}
+
 void pxtnDelayTone::Tone_Supple(const pxtnDelay &delay, int32_t ch,
                                 int32_t *group_smps) {
   if (!_smp_num) return;
@@ -80,6 +101,35 @@ void pxtnDelayTone::Tone_Increment() {
   if (++_offset >= _smp_num) _offset = 0;
 }
 
+void pxtnDelayTone::Tone_Supple_Block(const pxtnDelay &delay, int32_t ch,
+                                      int32_t *smps, int32_t smp_num) {
+  if (!_smp_num) return;
+  int32_t *p_buf = _bufs[ch].get();
+  bool b_played = delay.get_played();
+  int32_t offset = _offset;
+  for (int32_t i = 0; i < smp_num; i++) {
+    int32_t a = p_buf[offset] * _rate_s32 / 100;
+    if (b_played) smps[i] += a;
+    p_buf[offset] = smps[i];
+    if (++offset >= _smp_num) offset = 0;
+  }
+}
+
+void pxtnDelayTone::Tone_Increment_Block(int32_t smp_num) {
+  if (!_smp_num) return;
+  _offset = (int32_t)((_offset + (int64_t)smp_num) % _smp_num);
+}
+
+int32_t pxtnDelayTone::Tone_Settle_Smp() const {
+  if (!_smp_num) return 0;
+  int32_t pass = 1;
+  for (int32_t level = 0x100 * _rate_s32 / 100;
+       level > 0 && pass < pxtnDELAY_SETTLE_PASS_MAX;
+       level = level * _rate_s32 / 100)
+    pass++;
+  return _smp_num * pass;
+}
+
 void pxtnDelayTone::Tone_Clear() {
   if (!_smp_num) return;
   int32_t def = 0;  // ..
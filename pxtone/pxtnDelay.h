@@ -9,6 +9,8 @@
 #include "./pxtnDescriptor.h"
 #include "./pxtnMax.h"
 
+#define pxtnDELAY_SETTLE_PASS_MAX 8
+
 enum DELAYUNIT : int8_t {
   DELAYUNIT_Beat = 0,
   DELAYUNIT_Meas,
@@ -54,9 +56,23 @@ class pxtnDelayTone {
  public:
   pxtnDelayTone(const pxtnDelay& delay, int32_t beat_num, float beat_tempo,
                 int32_t sps);
+  // Copies duplicate the delay line, so that a mooState can be snapshotted.
+  pxtnDelayTone(const pxtnDelayTone& src);
+  pxtnDelayTone& operator=(const pxtnDelayTone& src);
+  pxtnDelayTone(pxtnDelayTone&& src) = default;
+  pxtnDelayTone& operator=(pxtnDelayTone&& src) = default;
   void Tone_Supple(const pxtnDelay& delay, int32_t ch_num, int32_t* group_smps);
   void Tone_Increment();
+  // Tone_Supple over [smp_num] samples of channel [ch] of the delay's group.
+  // Every channel starts from the same offset, so call Tone_Increment_Block
+  // only after all channels are done.
+  void Tone_Supple_Block(const pxtnDelay& delay, int32_t ch, int32_t* smps,
+                         int32_t smp_num);
+  void Tone_Increment_Block(int32_t smp_num);
   void Tone_Clear();
+  // How many samples the line takes to forget what it holds: whole passes
+  // until its feedback falls below 1/256, at most pxtnDELAY_SETTLE_PASS_MAX.
+  int32_t Tone_Settle_Smp() const;
 };
 
 #endif
@@ -6,6 +6,7 @@
 pxtnDescriptor::pxtnDescriptor() {
   _p_file = NULL;
   _p_data = NULL;
+  _p_buf_w = NULL;
   _size = 0;
   _b_read = false;
   _cur = 0;
@@ -17,12 +18,24 @@ bool pxtnDescriptor::set_memory_r(const void *p_mem, int size) {
   if (!p_mem || size < 1) return false;
   _p_file = NULL;
   _p_data = p_mem;
+  _p_buf_w = NULL;
   _size = size;
   _b_read = true;
   _cur = 0;
   return true;
 }
 
+bool pxtnDescriptor::set_memory_w(std::vector<uint8_t> *p_buf) {
+  if (!p_buf) return false;
+  _p_file = NULL;
+  _p_data = NULL;
+  _p_buf_w = p_buf;
+  _size = 0;
+  _b_read = false;
+  _cur = 0;
+  return true;
+}
+
 bool pxtnDescriptor::set_file_r(FILE *fd) {
   if (!fd) return false;
 
@@ -31,6 +44,7 @@ bool pxtnDescriptor::set_file_r(FILE *fd) {
   if (fseek(fd, 0, SEEK_SET)) return false;
   _p_file = fd;
   _p_data = NULL;
+  _p_buf_w = NULL;
 
   _b_read = true;
   _cur = 0;
@@ -42,6 +56,7 @@ bool pxtnDescriptor::set_file_w(FILE *fd) {
 
   _p_file = fd;
   _p_data = NULL;
+  _p_buf_w = NULL;
   _size = 0;
   _b_read = false;
   _cur = 0;
@@ -77,9 +92,15 @@ bool pxtnDescriptor::seek(pxtnSEEK mode, int val) {
 bool pxtnDescriptor::w_asfile(const void *p, int size, int num) {
   bool b_ret = false;
 
-  if (!_p_file || _b_read) goto End;
+  if (_b_read) goto End;
 
-  if (int(fwrite(p, size, num, _p_file)) != num) goto End;
+  if (_p_file) {
+    if (int(fwrite(p, size, num, _p_file)) != num) goto End;
+  } else if (_p_buf_w) {
+    _p_buf_w->insert(_p_buf_w->end(), (const uint8_t *)p,
+                     (const uint8_t *)p + size * num);
+  } else
+    goto End;
   _size += size * num;
 
   b_ret = true;
@@ -124,7 +145,7 @@ int pxtnDescriptor_v_chk(int val) {
 
 // ..uint32_t
 int pxtnDescriptor::v_w_asfile(int val, int *p_add) {
-  if (!_p_file) return 0;
+  if (!_p_file && !_p_buf_w) return 0;
   if (_b_read) return 0;
 
   uint8_t a[5]{};
@@ -177,9 +198,8 @@ int pxtnDescriptor::v_w_asfile(int val, int *p_add) {
     b[3] = (a[2] >> 5) | ((a[3] << 3) & 0x7F) | 0x80;
     b[4] = (a[3] >> 4) | ((a[4] << 4) & 0x7F);
   }
-  if (int32_t(fwrite(b, 1, bytes, _p_file)) != bytes) return false;
+  if (!w_asfile(b, 1, bytes)) return false;
   if (p_add) *p_add += bytes;
-  _size += bytes;
   return true;
 
   return false;
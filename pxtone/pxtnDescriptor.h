@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #include <memory>
+#include <vector>
 
 #include "./pxtn.h"
 
@@ -31,6 +32,7 @@ class pxtnDescriptor {
 
   FILE *_p_file;
   const void *_p_data;
+  std::vector<uint8_t> *_p_buf_w;
   bool _b_read;
   int32_t _size;
   int32_t _cur;
@@ -42,6 +44,8 @@ class pxtnDescriptor {
   bool set_file_r(FILE *fp);
   bool set_file_w(FILE *fp);
   bool set_memory_r(const void *p_mem, int len);
+  // Writes are appended to [p_buf].
+  bool set_memory_w(std::vector<uint8_t> *p_buf);
   bool seek(pxtnSEEK mode, int val);
 
   bool w_asfile(const void *p, int size, int num);
@@ -0,0 +1,576 @@
+#include "./pxtnMix.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define pxtnMIX_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define pxtnMIX_TARGET(x)
+#else
+#define pxtnMIX_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define pxtnMIX_NEON
+#include <arm_neon.h>
+#endif
+
+struct _MIXKERNELS {
+  pxtnMIXLEVEL level;
+  void (*gain)(int32_t* p, int32_t num, int32_t velocity, int32_t volume,
+               int32_t pan_vol, const int32_t* env);
+  void (*add)(int32_t* dst, const int32_t* src, int32_t num);
+  void (*overdrive)(int32_t* p, int32_t num, int32_t top, float amp);
+  void (*to_s16)(const int32_t* src, int16_t* dst, int32_t num, float vol,
+                 int32_t top);
+  void (*to_f32)(const int32_t* src, float* dst, int32_t num, float vol,
+                 bool b_clamp, float top);
+  float (*dot)(const float* a, const float* b, int32_t num);
+};
+
+////////////////////////////////////////////////
+// scalar. the reference for the other levels.
+////////////////////////////////////////////////
+
+static void _Gain_scalar(int32_t* p, int32_t num, int32_t velocity,
+                         int32_t volume, int32_t pan_vol, const int32_t* env) {
+  for (int32_t i = 0; i < num; i++) {
+    int32_t work = p[i];
+    work = (work * velocity) / 128;
+    work = (work * volume) / 128;
+    work = work * pan_vol / 64;
+    if (env) work = work * env[i] / 128;
+    p[i] = work;
+  }
+}
+
+static void _Add_scalar(int32_t* dst, const int32_t* src, int32_t num) {
+  for (int32_t i = 0; i < num; i++) dst[i] += src[i];
+}
+
+static void _OverDrive_scalar(int32_t* p, int32_t num, int32_t top,
+                              float amp) {
+  for (int32_t i = 0; i < num; i++) {
+    int32_t work = p[i];
+    if (work > top)
+      work = top;
+    else if (work < -top)
+      work = -top;
+    p[i] = (int32_t)((float)work * amp);
+  }
+}
+
+static void _ToS16_scalar(const int32_t* src, int16_t* dst, int32_t num,
+                          float vol, int32_t top) {
+  for (int32_t i = 0; i < num; i++) {
+    int32_t work = (int32_t)(src[i] * vol);
+    if (work > top) work = top;
+    if (work < -top) work = -top;
+    dst[i] = (int16_t)work;
+  }
+}
+
+static void _ToF32_scalar(const int32_t* src, float* dst, int32_t num,
+                          float vol, bool b_clamp, float top) {
+  if (!b_clamp) {
+    for (int32_t i = 0; i < num; i++) dst[i] = src[i] * vol;
+    return;
+  }
+  for (int32_t i = 0; i < num; i++) {
+    float work = src[i] * vol;
+    if (work > top) work = top;
+    if (work < -top) work = -top;
+    dst[i] = work;
+  }
+}
+
+// Adds the last (num < 8) products to the lanes and sums them up. Every level
+// ends here so that the order of additions is the same.
+static float _Dot_finish(float* lanes, const float* a, const float* b,
+                         int32_t num) {
+  for (int32_t j = 0; j < num; j++) lanes[j] += a[j] * b[j];
+  float l0 = lanes[0] + lanes[4];
+  float l1 = lanes[1] + lanes[5];
+  float l2 = lanes[2] + lanes[6];
+  float l3 = lanes[3] + lanes[7];
+  return (l0 + l2) + (l1 + l3);
+}
+
+static float _Dot_scalar(const float* a, const float* b, int32_t num) {
+  float lanes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    for (int32_t j = 0; j < 8; j++) lanes[j] += a[i + j] * b[i + j];
+  }
+  return _Dot_finish(lanes, a + i, b + i, num - i);
+}
+
+static const _MIXKERNELS _kernels_scalar = {
+    pxtnMIX_Scalar, _Gain_scalar,  _Add_scalar,  _OverDrive_scalar,
+    _ToS16_scalar,  _ToF32_scalar, _Dot_scalar,
+};
+
+#ifdef pxtnMIX_X86
+
+////////////////////////////////////////////////
+// SSE2
+////////////////////////////////////////////////
+
+// SSE2 has no 32-bit mullo. The low halves of unsigned products are the same
+// as for signed ones.
+pxtnMIX_TARGET("sse2")
+static inline __m128i _mullo_sse2(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// x / (1 << shift), truncating towards zero.
+pxtnMIX_TARGET("sse2")
+static inline __m128i _div_pow2_sse2(__m128i x, int shift) {
+  __m128i bias = _mm_and_si128(_mm_srai_epi32(x, 31),
+                               _mm_set1_epi32((1 << shift) - 1));
+  return _mm_sra_epi32(_mm_add_epi32(x, bias), _mm_cvtsi32_si128(shift));
+}
+
+pxtnMIX_TARGET("sse2")
+static inline __m128i _clamp_sse2(__m128i x, __m128i top, __m128i bottom) {
+  __m128i over = _mm_cmpgt_epi32(x, top);
+  x = _mm_or_si128(_mm_and_si128(over, top), _mm_andnot_si128(over, x));
+  __m128i under = _mm_cmplt_epi32(x, bottom);
+  return _mm_or_si128(_mm_and_si128(under, bottom),
+                      _mm_andnot_si128(under, x));
+}
+
+pxtnMIX_TARGET("sse2")
+static void _Gain_sse2(int32_t* p, int32_t num, int32_t velocity,
+                       int32_t volume, int32_t pan_vol, const int32_t* env) {
+  __m128i vel = _mm_set1_epi32(velocity);
+  __m128i vol = _mm_set1_epi32(volume);
+  __m128i pan = _mm_set1_epi32(pan_vol);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i work = _mm_loadu_si128((const __m128i*)(p + i));
+    work = _div_pow2_sse2(_mullo_sse2(work, vel), 7);
+    work = _div_pow2_sse2(_mullo_sse2(work, vol), 7);
+    work = _div_pow2_sse2(_mullo_sse2(work, pan), 6);
+    if (env) {
+      __m128i e = _mm_loadu_si128((const __m128i*)(env + i));
+      work = _div_pow2_sse2(_mullo_sse2(work, e), 7);
+    }
+    _mm_storeu_si128((__m128i*)(p + i), work);
+  }
+  _Gain_scalar(p + i, num - i, velocity, volume, pan_vol, env ? env + i : NULL);
+}
+
+pxtnMIX_TARGET("sse2")
+static void _Add_sse2(int32_t* dst, const int32_t* src, int32_t num) {
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(a, b));
+  }
+  _Add_scalar(dst + i, src + i, num - i);
+}
+
+pxtnMIX_TARGET("sse2")
+static void _OverDrive_sse2(int32_t* p, int32_t num, int32_t top, float amp) {
+  __m128i t = _mm_set1_epi32(top);
+  __m128i b = _mm_set1_epi32(-top);
+  __m128 a = _mm_set1_ps(amp);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i work = _clamp_sse2(_mm_loadu_si128((const __m128i*)(p + i)), t, b);
+    work = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(work), a));
+    _mm_storeu_si128((__m128i*)(p + i), work);
+  }
+  _OverDrive_scalar(p + i, num - i, top, amp);
+}
+
+pxtnMIX_TARGET("sse2")
+static void _ToS16_sse2(const int32_t* src, int16_t* dst, int32_t num,
+                        float vol, int32_t top) {
+  __m128 v = _mm_set1_ps(vol);
+  __m128i t = _mm_set1_epi32(top);
+  __m128i b = _mm_set1_epi32(-top);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 4));
+    lo = _clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), v)), t, b);
+    hi = _clamp_sse2(_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), v)), t, b);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi));
+  }
+  _ToS16_scalar(src + i, dst + i, num - i, vol, top);
+}
+
+pxtnMIX_TARGET("sse2")
+static void _ToF32_sse2(const int32_t* src, float* dst, int32_t num, float vol,
+                        bool b_clamp, float top) {
+  __m128 v = _mm_set1_ps(vol);
+  __m128 t = _mm_set1_ps(top);
+  __m128 b = _mm_set1_ps(-top);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128 work = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + i))), v);
+    if (b_clamp) work = _mm_max_ps(_mm_min_ps(work, t), b);
+    _mm_storeu_ps(dst + i, work);
+  }
+  _ToF32_scalar(src + i, dst + i, num - i, vol, b_clamp, top);
+}
+
+pxtnMIX_TARGET("sse2")
+static float _Dot_sse2(const float* a, const float* b, int32_t num) {
+  __m128 lo = _mm_setzero_ps();
+  __m128 hi = _mm_setzero_ps();
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    lo = _mm_add_ps(lo, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    hi = _mm_add_ps(hi, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                   _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[8];
+  _mm_storeu_ps(lanes, lo);
+  _mm_storeu_ps(lanes + 4, hi);
+  return _Dot_finish(lanes, a + i, b + i, num - i);
+}
+
+static const _MIXKERNELS _kernels_sse2 = {
+    pxtnMIX_SSE2, _Gain_sse2,  _Add_sse2,   _OverDrive_sse2,
+    _ToS16_sse2,  _ToF32_sse2, _Dot_sse2,
+};
+
+////////////////////////////////////////////////
+// AVX2
+////////////////////////////////////////////////
+
+pxtnMIX_TARGET("avx2")
+static inline __m256i _div_pow2_avx2(__m256i x, int shift) {
+  __m256i bias = _mm256_and_si256(_mm256_srai_epi32(x, 31),
+                                  _mm256_set1_epi32((1 << shift) - 1));
+  return _mm256_sra_epi32(_mm256_add_epi32(x, bias),
+                          _mm_cvtsi32_si128(shift));
+}
+
+pxtnMIX_TARGET("avx2")
+static void _Gain_avx2(int32_t* p, int32_t num, int32_t velocity,
+                       int32_t volume, int32_t pan_vol, const int32_t* env) {
+  __m256i vel = _mm256_set1_epi32(velocity);
+  __m256i vol = _mm256_set1_epi32(volume);
+  __m256i pan = _mm256_set1_epi32(pan_vol);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i work = _mm256_loadu_si256((const __m256i*)(p + i));
+    work = _div_pow2_avx2(_mm256_mullo_epi32(work, vel), 7);
+    work = _div_pow2_avx2(_mm256_mullo_epi32(work, vol), 7);
+    work = _div_pow2_avx2(_mm256_mullo_epi32(work, pan), 6);
+    if (env) {
+      __m256i e = _mm256_loadu_si256((const __m256i*)(env + i));
+      work = _div_pow2_avx2(_mm256_mullo_epi32(work, e), 7);
+    }
+    _mm256_storeu_si256((__m256i*)(p + i), work);
+  }
+  _Gain_scalar(p + i, num - i, velocity, volume, pan_vol, env ? env + i : NULL);
+}
+
+pxtnMIX_TARGET("avx2")
+static void _Add_avx2(int32_t* dst, const int32_t* src, int32_t num) {
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(a, b));
+  }
+  _Add_scalar(dst + i, src + i, num - i);
+}
+
+pxtnMIX_TARGET("avx2")
+static void _OverDrive_avx2(int32_t* p, int32_t num, int32_t top, float amp) {
+  __m256i t = _mm256_set1_epi32(top);
+  __m256i b = _mm256_set1_epi32(-top);
+  __m256 a = _mm256_set1_ps(amp);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i work = _mm256_loadu_si256((const __m256i*)(p + i));
+    work = _mm256_max_epi32(_mm256_min_epi32(work, t), b);
+    work = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(work), a));
+    _mm256_storeu_si256((__m256i*)(p + i), work);
+  }
+  _OverDrive_scalar(p + i, num - i, top, amp);
+}
+
+pxtnMIX_TARGET("avx2")
+static void _ToS16_avx2(const int32_t* src, int16_t* dst, int32_t num,
+                        float vol, int32_t top) {
+  __m256 v = _mm256_set1_ps(vol);
+  __m256i t = _mm256_set1_epi32(top);
+  __m256i b = _mm256_set1_epi32(-top);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i work = _mm256_loadu_si256((const __m256i*)(src + i));
+    work = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(work), v));
+    work = _mm256_max_epi32(_mm256_min_epi32(work, t), b);
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(work),
+                                     _mm256_extracti128_si256(work, 1));
+    _mm_storeu_si128((__m128i*)(dst + i), packed);
+  }
+  _ToS16_scalar(src + i, dst + i, num - i, vol, top);
+}
+
+pxtnMIX_TARGET("avx2")
+static void _ToF32_avx2(const int32_t* src, float* dst, int32_t num, float vol,
+                        bool b_clamp, float top) {
+  __m256 v = _mm256_set1_ps(vol);
+  __m256 t = _mm256_set1_ps(top);
+  __m256 b = _mm256_set1_ps(-top);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256 work = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + i))), v);
+    if (b_clamp) work = _mm256_max_ps(_mm256_min_ps(work, t), b);
+    _mm256_storeu_ps(dst + i, work);
+  }
+  _ToF32_scalar(src + i, dst + i, num - i, vol, b_clamp, top);
+}
+
+pxtnMIX_TARGET("avx2")
+static float _Dot_avx2(const float* a, const float* b, int32_t num) {
+  __m256 acc = _mm256_setzero_ps();
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    acc = _mm256_add_ps(
+        acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  return _Dot_finish(lanes, a + i, b + i, num - i);
+}
+
+static const _MIXKERNELS _kernels_avx2 = {
+    pxtnMIX_AVX2, _Gain_avx2,  _Add_avx2,   _OverDrive_avx2,
+    _ToS16_avx2,  _ToF32_avx2, _Dot_avx2,
+};
+
+static bool _x86_has_sse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return true;
+#elif defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] >> 26) & 1;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool _x86_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  // The OS has to save the YMM registers too.
+  if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1)) return false;
+  if ((_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] >> 5) & 1;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // pxtnMIX_X86
+
+#ifdef pxtnMIX_NEON
+
+////////////////////////////////////////////////
+// NEON
+////////////////////////////////////////////////
+
+template <int shift>
+static inline int32x4_t _div_pow2_neon(int32x4_t x) {
+  int32x4_t bias =
+      vandq_s32(vshrq_n_s32(x, 31), vdupq_n_s32((1 << shift) - 1));
+  return vshrq_n_s32(vaddq_s32(x, bias), shift);
+}
+
+static void _Gain_neon(int32_t* p, int32_t num, int32_t velocity,
+                       int32_t volume, int32_t pan_vol, const int32_t* env) {
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    int32x4_t work = vld1q_s32(p + i);
+    work = _div_pow2_neon<7>(vmulq_n_s32(work, velocity));
+    work = _div_pow2_neon<7>(vmulq_n_s32(work, volume));
+    work = _div_pow2_neon<6>(vmulq_n_s32(work, pan_vol));
+    if (env) work = _div_pow2_neon<7>(vmulq_s32(work, vld1q_s32(env + i)));
+    vst1q_s32(p + i, work);
+  }
+  _Gain_scalar(p + i, num - i, velocity, volume, pan_vol, env ? env + i : NULL);
+}
+
+static void _Add_neon(int32_t* dst, const int32_t* src, int32_t num) {
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4)
+    vst1q_s32(dst + i, vaddq_s32(vld1q_s32(dst + i), vld1q_s32(src + i)));
+  _Add_scalar(dst + i, src + i, num - i);
+}
+
+static void _OverDrive_neon(int32_t* p, int32_t num, int32_t top, float amp) {
+  int32x4_t t = vdupq_n_s32(top);
+  int32x4_t b = vdupq_n_s32(-top);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    int32x4_t work = vmaxq_s32(vminq_s32(vld1q_s32(p + i), t), b);
+    vst1q_s32(p + i, vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(work), amp)));
+  }
+  _OverDrive_scalar(p + i, num - i, top, amp);
+}
+
+static void _ToS16_neon(const int32_t* src, int16_t* dst, int32_t num,
+                        float vol, int32_t top) {
+  int32x4_t t = vdupq_n_s32(top);
+  int32x4_t b = vdupq_n_s32(-top);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    int32x4_t work =
+        vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), vol));
+    work = vmaxq_s32(vminq_s32(work, t), b);
+    vst1_s16(dst + i, vqmovn_s32(work));
+  }
+  _ToS16_scalar(src + i, dst + i, num - i, vol, top);
+}
+
+static void _ToF32_neon(const int32_t* src, float* dst, int32_t num, float vol,
+                        bool b_clamp, float top) {
+  float32x4_t t = vdupq_n_f32(top);
+  float32x4_t b = vdupq_n_f32(-top);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    float32x4_t work = vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), vol);
+    if (b_clamp) work = vmaxq_f32(vminq_f32(work, t), b);
+    vst1q_f32(dst + i, work);
+  }
+  _ToF32_scalar(src + i, dst + i, num - i, vol, b_clamp, top);
+}
+
+static float _Dot_neon(const float* a, const float* b, int32_t num) {
+  float32x4_t lo = vdupq_n_f32(0);
+  float32x4_t hi = vdupq_n_f32(0);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    lo = vaddq_f32(lo, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    hi = vaddq_f32(hi, vmulq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+  }
+  float lanes[8];
+  vst1q_f32(lanes, lo);
+  vst1q_f32(lanes + 4, hi);
+  return _Dot_finish(lanes, a + i, b + i, num - i);
+}
+
+static const _MIXKERNELS _kernels_neon = {
+    pxtnMIX_NEON, _Gain_neon,  _Add_neon,   _OverDrive_neon,
+    _ToS16_neon,  _ToF32_neon, _Dot_neon,
+};
+
+#endif  // pxtnMIX_NEON
+
+////////////////////////////////////////////////
+// dispatch
+////////////////////////////////////////////////
+
+static const _MIXKERNELS* _kernels_for(pxtnMIXLEVEL level) {
+  switch (level) {
+    case pxtnMIX_Scalar:
+      return &_kernels_scalar;
+#ifdef pxtnMIX_X86
+    case pxtnMIX_SSE2:
+      return _x86_has_sse2() ? &_kernels_sse2 : NULL;
+    case pxtnMIX_AVX2:
+      return _x86_has_avx2() ? &_kernels_avx2 : NULL;
+#endif
+#ifdef pxtnMIX_NEON
+    case pxtnMIX_NEON:
+      return &_kernels_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+static const _MIXKERNELS* _kernels_detect() {
+  const pxtnMIXLEVEL order[] = {pxtnMIX_AVX2, pxtnMIX_NEON, pxtnMIX_SSE2};
+  for (pxtnMIXLEVEL level : order) {
+    const _MIXKERNELS* k = _kernels_for(level);
+    if (k) return k;
+  }
+  return &_kernels_scalar;
+}
+
+static std::atomic<const _MIXKERNELS*> _p_kernels{NULL};
+
+static inline const _MIXKERNELS* _kernels() {
+  const _MIXKERNELS* k = _p_kernels.load(std::memory_order_relaxed);
+  if (!k) {
+    // Racing callers detect the same thing, so there's nothing to lock.
+    k = _kernels_detect();
+    _p_kernels.store(k, std::memory_order_relaxed);
+  }
+  return k;
+}
+
+pxtnMIXLEVEL pxtnMix_get_level() { return _kernels()->level; }
+
+bool pxtnMix_set_level(pxtnMIXLEVEL level) {
+  const _MIXKERNELS* k = _kernels_for(level);
+  if (!k) return false;
+  _p_kernels.store(k, std::memory_order_relaxed);
+  return true;
+}
+
+const char* pxtnMix_get_level_name(pxtnMIXLEVEL level) {
+  switch (level) {
+    case pxtnMIX_Scalar:
+      return "scalar";
+    case pxtnMIX_SSE2:
+      return "SSE2";
+    case pxtnMIX_AVX2:
+      return "AVX2";
+    case pxtnMIX_NEON:
+      return "NEON";
+  }
+  return "?";
+}
+
+void pxtnMix_Gain(int32_t* p, int32_t num, int32_t velocity, int32_t volume,
+                  int32_t pan_vol, const int32_t* env) {
+  _kernels()->gain(p, num, velocity, volume, pan_vol, env);
+}
+
+void pxtnMix_Add(int32_t* dst, const int32_t* src, int32_t num) {
+  _kernels()->add(dst, src, num);
+}
+
+void pxtnMix_OverDrive(int32_t* p, int32_t num, int32_t top, float amp) {
+  _kernels()->overdrive(p, num, top, amp);
+}
+
+void pxtnMix_ToS16(const int32_t* src, int16_t* dst, int32_t num, float vol,
+                   int32_t top) {
+  _kernels()->to_s16(src, dst, num, vol, top);
+}
+
+void pxtnMix_ToF32(const int32_t* src, float* dst, int32_t num, float vol,
+                   bool b_clamp, float top) {
+  _kernels()->to_f32(src, dst, num, vol, b_clamp, top);
+}
+
+float pxtnMix_Dot(const float* a, const float* b, int32_t num) {
+  return _kernels()->dot(a, b, num);
+}
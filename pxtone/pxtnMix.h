@@ -0,0 +1,43 @@
+// pxtnMix: vector kernels for the block renderer.
+
+#ifndef pxtnMix_H
+#define pxtnMix_H
+
+#include "./pxtn.h"
+
+/* Every kernel gives exactly the same result as the scalar code it replaces,
+ * whichever level is in use. The best level the CPU supports is picked on
+ * first use. */
+enum pxtnMIXLEVEL : int8_t {
+  pxtnMIX_Scalar = 0,
+  pxtnMIX_SSE2,
+  pxtnMIX_AVX2,
+  pxtnMIX_NEON,
+};
+
+pxtnMIXLEVEL pxtnMix_get_level();
+// Forces a level, e.g. to compare against the scalar path. Returns false if
+// the CPU doesn't support it.
+bool pxtnMix_set_level(pxtnMIXLEVEL level);
+const char* pxtnMix_get_level_name(pxtnMIXLEVEL level);
+
+// p[i] = ((p[i] * velocity / 128) * volume / 128) * pan_vol / 64, then
+// * env[i] / 128 if [env] is given. Divisions truncate like C's.
+void pxtnMix_Gain(int32_t* p, int32_t num, int32_t velocity, int32_t volume,
+                  int32_t pan_vol, const int32_t* env);
+// dst[i] += src[i]
+void pxtnMix_Add(int32_t* dst, const int32_t* src, int32_t num);
+// Clamps to +-top, then scales by [amp] (pxtnOverDrive::Tone_Supple).
+void pxtnMix_OverDrive(int32_t* p, int32_t num, int32_t top, float amp);
+// dst[i] = clamp((int32_t)(src[i] * vol), +-top)
+void pxtnMix_ToS16(const int32_t* src, int16_t* dst, int32_t num, float vol,
+                   int32_t top);
+// dst[i] = src[i] * vol, clamped to +-top if [b_clamp].
+void pxtnMix_ToF32(const int32_t* src, float* dst, int32_t num, float vol,
+                   bool b_clamp, float top);
+// sum of a[i] * b[i], accumulated in 8 lanes that are added up in a fixed
+// order, so every level gives the same sum unless the compiler fuses the
+// scalar multiply-adds (e.g. -ffp-contract on FMA targets).
+float pxtnMix_Dot(const float* a, const float* b, int32_t num);
+
+#endif
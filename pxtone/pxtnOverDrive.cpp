@@ -3,6 +3,7 @@
 #include "./pxtnOverDrive.h"
 
 #include "./pxtn.h"
+#include "./pxtnMix.h"
 
 pxtnOverDrive::pxtnOverDrive() { _b_played = true; }
 
@@ -43,6 +44,11 @@ void pxtnOverDrive::Tone_Supple(int32_t *group_smps) const {
   group_smps[_group] = (int32_t)((float)work * _amp_f);
 }
 
+void pxtnOverDrive::Tone_Supple_Block(int32_t *smps, int32_t smp_num) const {
+  if (!_b_played) return;
+  pxtnMix_OverDrive(smps, smp_num, _cut_16bit_top, _amp_f);
+}
+
 // (8byte) =================
 typedef struct {
   uint16_t xxx;
@@ -34,6 +34,8 @@ class pxtnOverDrive {
 
   void Tone_Ready();
   void Tone_Supple(int32_t *group_smps) const;
+  // Tone_Supple over [smp_num] samples of the overdrive's group.
+  void Tone_Supple_Block(int32_t *smps, int32_t smp_num) const;
 
   bool Write(pxtnDescriptor *p_doc) const;
   pxtnERR Read(pxtnDescriptor *p_doc);
@@ -82,7 +82,7 @@ constexpr std::array<float, _TABLE_SIZE> compute_freq_table() {
   return freq_table;
 }
 // Not constexpr b/c of msvc17
-static std::array<float, _TABLE_SIZE> _freq_table(compute_freq_table());
+static const std::array<float, _TABLE_SIZE> _freq_table(compute_freq_table());
 
 float pxtnPulse_Frequency::Get(int32_t key) {
   int32_t i;
@@ -17,6 +17,11 @@ pxNOISEDESIGN_UNIT *pxtnPulse_Noise::get_unit(int32_t u) {
   return &_units[u];
 }
 
+const pxNOISEDESIGN_UNIT *pxtnPulse_Noise::get_unit(int32_t u) const {
+  if (!_units || u < 0 || u >= _unit_num) return NULL;
+  return &_units[u];
+}
+
 pxtnPulse_Noise::pxtnPulse_Noise() {
   _units = NULL;
   _unit_num = 0;
@@ -76,6 +76,7 @@ class pxtnPulse_Noise {
   int32_t get_smp_num_44k() const;
   float get_sec() const;
   pxNOISEDESIGN_UNIT *get_unit(int32_t u);
+  const pxNOISEDESIGN_UNIT *get_unit(int32_t u) const;
 };
 
 #endif
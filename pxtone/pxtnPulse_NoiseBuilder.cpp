@@ -4,6 +4,8 @@
 #include "./pxtn.h"
 #include "./pxtnMem.h"
 
+#include <mutex>
+
 #define _BASIC_SPS 44100.0
 #define _BASIC_FREQUENCY 100.0  // 100 Hz
 #define _SAMPLING_TOP 32767     //  16 bit max
@@ -100,40 +102,42 @@ void _incriment(_OSCILLATOR *p_osc, double incriment, const short *p_tbl_rand) {
   }
 }
 
-pxtnPulse_NoiseBuilder::pxtnPulse_NoiseBuilder() {
-  _b_init = false;
-  for (int32_t i = 0; i < pxWAVETYPE_num; i++) _p_tables[i] = NULL;
-}
+// The tables only depend on constants, so every builder in the process reads
+// the same copy, filled by the first Init().
+typedef struct {
+  short wave[pxWAVETYPE_num][_smp_num];
+  short rand[_smp_num_rand];
+  const short *p_tables[pxWAVETYPE_num];
+} _TABLES;
 
-pxtnPulse_NoiseBuilder::~pxtnPulse_NoiseBuilder() {
-  _b_init = false;
-  for (int32_t i = 0; i < pxWAVETYPE_num; i++)
-    pxtnMem_free((void **)&_p_tables[i]);
-}
+static _TABLES _tables;
+static std::once_flag _tables_once;
 
-void pxtnPulse_NoiseBuilder::_random_reset() {
-  _rand_buf[0] = 0x4444;
-  _rand_buf[1] = 0x8888;
+static void _random_reset(int32_t *rand_buf) {
+  rand_buf[0] = 0x4444;
+  rand_buf[1] = 0x8888;
 }
 
-short pxtnPulse_NoiseBuilder::_random_get() {
+static short _random_get(int32_t *rand_buf) {
   int32_t w1, w2;
   char *p1;
   char *p2;
 
-  w1 = (short)_rand_buf[0] + _rand_buf[1];
+  w1 = (short)rand_buf[0] + rand_buf[1];
   p1 = (char *)&w1;
   p2 = (char *)&w2;
   p2[0] = p1[1];
   p2[1] = p1[0];
-  _rand_buf[1] = (short)_rand_buf[0];
-  _rand_buf[0] = (short)w2;
+  rand_buf[1] = (short)rand_buf[0];
+  rand_buf[0] = (short)w2;
 
   return (short)w2;
 }
 
 // prepare tables. (110Hz)
-bool pxtnPulse_NoiseBuilder::Init() {
+static void _Build_Tables() {
+  short *tables[pxWAVETYPE_num];
+  int32_t rand_buf[2];
   int32_t s;
   short *p;
   double work;
@@ -157,67 +161,15 @@ bool pxtnPulse_NoiseBuilder::Init() {
   pxtnPOINT coodi_tri[4] = {
       {0, 0}, {_smp_num / 4, 128}, {_smp_num * 3 / 4, -128}, {_smp_num, 0}};
 
-  if (_b_init) return true;
-
-  for (s = 0; s < pxWAVETYPE_num; s++) _p_tables[s] = NULL;
-
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_None],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Sine],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Random],
-                          sizeof(short) * _smp_num_rand))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw2],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect2],
-                          sizeof(short) * _smp_num))
-    goto End;
-
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Tri],
-                          sizeof(short) * _smp_num))
-    goto End;
-  //    if( !pxtnMem_zero_alloc( (void **)&_p_tables[ pxWAVETYPE_Random2 ],
-  //    sizeof(short) * _smp_num_rand ) ) goto End; x
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect3],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect4],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect8],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Rect16],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw3],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw4],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw6],
-                          sizeof(short) * _smp_num))
-    goto End;
-  if (!pxtnMem_zero_alloc((void **)&_p_tables[pxWAVETYPE_Saw8],
-                          sizeof(short) * _smp_num))
-    goto End;
+  for (s = 0; s < pxWAVETYPE_num; s++) tables[s] = _tables.wave[s];
+  tables[pxWAVETYPE_Random] = _tables.rand;
+  tables[pxWAVETYPE_Random2] = NULL;
 
   // none --
 
   // sine --
   osci.ReadyGetSample(overtones_sine, 1, 128, _smp_num, 0);
-  p = _p_tables[pxWAVETYPE_Sine];
+  p = tables[pxWAVETYPE_Sine];
   for (s = 0; s < _smp_num; s++) {
     work = osci.GetOneSample_Overtone(s);
     if (work > 1.0) work = 1.0;
@@ -227,7 +179,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // saw down --
-  p = _p_tables[pxWAVETYPE_Saw];
+  p = tables[pxWAVETYPE_Saw];
   work = _SAMPLING_TOP + _SAMPLING_TOP;
   for (s = 0; s < _smp_num; s++) {
     *p = (short)(_SAMPLING_TOP - work * s / _smp_num);
@@ -235,7 +187,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // rect --
-  p = _p_tables[pxWAVETYPE_Rect];
+  p = tables[pxWAVETYPE_Rect];
   for (s = 0; s < _smp_num / 2; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -246,16 +198,16 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // random --
-  p = _p_tables[pxWAVETYPE_Random];
-  _random_reset();
+  p = tables[pxWAVETYPE_Random];
+  _random_reset(rand_buf);
   for (s = 0; s < _smp_num_rand; s++) {
-    *p = _random_get();
+    *p = _random_get(rand_buf);
     p++;
   }
 
   // saw2 --
   osci.ReadyGetSample(overtones_saw2, 16, 128, _smp_num, 0);
-  p = _p_tables[pxWAVETYPE_Saw2];
+  p = tables[pxWAVETYPE_Saw2];
   for (s = 0; s < _smp_num; s++) {
     work = osci.GetOneSample_Overtone(s);
     if (work > 1.0) work = 1.0;
@@ -266,7 +218,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
 
   // rect2 --
   osci.ReadyGetSample(overtones_rect2, 8, 128, _smp_num, 0);
-  p = _p_tables[pxWAVETYPE_Rect2];
+  p = tables[pxWAVETYPE_Rect2];
   for (s = 0; s < _smp_num; s++) {
     work = osci.GetOneSample_Overtone(s);
     if (work > 1.0) work = 1.0;
@@ -277,7 +229,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
 
   // Triangle --
   osci.ReadyGetSample(coodi_tri, 4, 128, _smp_num, _smp_num);
-  p = _p_tables[pxWAVETYPE_Tri];
+  p = tables[pxWAVETYPE_Tri];
   for (s = 0; s < _smp_num; s++) {
     work = osci.GetOneSample_Coodinate(s);
     if (work > 1.0) work = 1.0;
@@ -289,7 +241,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   // Random2  -- x
 
   // Rect-3  --
-  p = _p_tables[pxWAVETYPE_Rect3];
+  p = tables[pxWAVETYPE_Rect3];
   for (s = 0; s < _smp_num / 3; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -299,7 +251,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
     p++;
   }
   // Rect-4   --
-  p = _p_tables[pxWAVETYPE_Rect4];
+  p = tables[pxWAVETYPE_Rect4];
   for (s = 0; s < _smp_num / 4; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -309,7 +261,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
     p++;
   }
   // Rect-8   --
-  p = _p_tables[pxWAVETYPE_Rect8];
+  p = tables[pxWAVETYPE_Rect8];
   for (s = 0; s < _smp_num / 8; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -319,7 +271,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
     p++;
   }
   // Rect-16  --
-  p = _p_tables[pxWAVETYPE_Rect16];
+  p = tables[pxWAVETYPE_Rect16];
   for (s = 0; s < _smp_num / 16; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -330,7 +282,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // Saw-3    --
-  p = _p_tables[pxWAVETYPE_Saw3];
+  p = tables[pxWAVETYPE_Saw3];
   for (s = 0; s < _smp_num / 3; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -345,7 +297,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // Saw-4    --
-  p = _p_tables[pxWAVETYPE_Saw4];
+  p = tables[pxWAVETYPE_Saw4];
   for (s = 0; s < _smp_num / 4; s++) {
     *p = (short)(_SAMPLING_TOP);
     p++;
@@ -364,7 +316,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // Saw-6    --
-  p = _p_tables[pxWAVETYPE_Saw6];
+  p = tables[pxWAVETYPE_Saw6];
   a = _smp_num * 1 / 6;
   v = _SAMPLING_TOP;
   for (s = 0; s < a; s++) {
@@ -403,7 +355,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
   }
 
   // Saw-8    --
-  p = _p_tables[pxWAVETYPE_Saw8];
+  p = tables[pxWAVETYPE_Saw8];
   a = _smp_num * 1 / 8;
   v = _SAMPLING_TOP;
   for (s = 0; s < a; s++) {
@@ -453,10 +405,172 @@ bool pxtnPulse_NoiseBuilder::Init() {
     p++;
   }
 
+  for (s = 0; s < pxWAVETYPE_num; s++) _tables.p_tables[s] = tables[s];
+}
+
+pxtnPulse_NoiseBuilder::pxtnPulse_NoiseBuilder() {
+  _b_init = false;
+  _p_tables = NULL;
+  _task_runner = NULL;
+  _task_runner_user = NULL;
+}
+
+pxtnPulse_NoiseBuilder::~pxtnPulse_NoiseBuilder() { _b_init = false; }
+
+bool pxtnPulse_NoiseBuilder::Init() {
+  if (_b_init) return true;
+  std::call_once(_tables_once, _Build_Tables);
+  _p_tables = _tables.p_tables;
   _b_init = true;
-End:
+  return true;
+}
+
+// Oscillator output before bReverse and volume.
+template <_RANDOMTYPE T>
+static inline double _osc_value(const _OSCILLATOR *po) {
+  switch (T) {
+    case _RANDOM_None:
+      return (double)po->p_smp[(int32_t)po->offset];
+    case _RANDOM_Saw:
+      return po->rdm_start + po->rdm_margin * (int32_t)po->offset / _smp_num;
+    default:
+      return po->rdm_start;
+  }
+}
 
-  return _b_init;
+// Volume oscillator: one value per sample, then steps.
+template <_RANDOMTYPE T>
+static void _Volu_Block(_OSCILLATOR *po, const short *p_tbl_rand,
+                        double *p_dst, int32_t num) {
+  for (int32_t i = 0; i < num; i++) {
+    double v = _osc_value<T>(po);
+    if (po->bReverse) v *= -1;
+    v *= po->volume;
+    p_dst[i] = v;
+    _incriment(po, po->incriment, p_tbl_rand);
+  }
+}
+
+// Frequency oscillator. Its table output is scaled to keys.
+template <_RANDOMTYPE T>
+static void _Freq_Block(_OSCILLATOR *po, const short *p_tbl_rand,
+                        double *p_dst, int32_t num) {
+  for (int32_t i = 0; i < num; i++) {
+    double v;
+    if (T == _RANDOM_None)
+      v = _KEY_TOP * po->p_smp[(int32_t)po->offset] / _SAMPLING_TOP;
+    else
+      v = _osc_value<T>(po);
+    if (po->bReverse) v *= -1;
+    v *= po->volume;
+    p_dst[i] = v;
+    _incriment(po, po->incriment, p_tbl_rand);
+  }
+}
+
+// Main oscillator, stepped at a rate modulated by [p_fre].
+template <_RANDOMTYPE T>
+static void _Main_Block(_OSCILLATOR *po, const short *p_tbl_rand,
+                        const double *p_fre, double *p_dst, int32_t num) {
+  for (int32_t i = 0; i < num; i++) {
+    double v = 0;
+    if (T == _RANDOM_None ? (int32_t)po->offset >= 0 : po->offset >= 0)
+      v = _osc_value<T>(po);
+    if (po->bReverse) v *= -1;
+    v *= po->volume;
+    p_dst[i] = v;
+    _incriment(po, po->incriment * pxtnPulse_Frequency::Get((int32_t)p_fre[i]),
+               p_tbl_rand);
+  }
+}
+
+typedef void (*_OSCBLOCK)(_OSCILLATOR *po, const short *p_tbl_rand,
+                          double *p_dst, int32_t num);
+typedef void (*_MAINBLOCK)(_OSCILLATOR *po, const short *p_tbl_rand,
+                           const double *p_fre, double *p_dst, int32_t num);
+
+static const _OSCBLOCK _volu_blocks[] = {_Volu_Block<_RANDOM_None>,
+                                         _Volu_Block<_RANDOM_Saw>,
+                                         _Volu_Block<_RANDOM_Rect>};
+static const _OSCBLOCK _freq_blocks[] = {_Freq_Block<_RANDOM_None>,
+                                         _Freq_Block<_RANDOM_Saw>,
+                                         _Freq_Block<_RANDOM_Rect>};
+static const _MAINBLOCK _main_blocks[] = {_Main_Block<_RANDOM_None>,
+                                          _Main_Block<_RANDOM_Saw>,
+                                          _Main_Block<_RANDOM_Rect>};
+
+static void _Envelope_Block(_UNIT *pU, double *p_dst, int32_t num) {
+  for (int32_t i = 0; i < num; i++) {
+    if (pU->enve_index < pU->enve_num) {
+      p_dst[i] = pU->enve_mag_start + (pU->enve_mag_margin * pU->enve_count /
+                                       pU->enves[pU->enve_index].smp);
+      pU->enve_count++;
+      if (pU->enve_count >= pU->enves[pU->enve_index].smp) {
+        pU->enve_count = 0;
+        pU->enve_mag_start = pU->enves[pU->enve_index].mag;
+        pU->enve_mag_margin = 0;
+        pU->enve_index++;
+        while (pU->enve_index < pU->enve_num) {
+          pU->enve_mag_margin =
+              pU->enves[pU->enve_index].mag - pU->enve_mag_start;
+          if (pU->enves[pU->enve_index].smp) break;
+          pU->enve_mag_start = pU->enves[pU->enve_index].mag;
+          pU->enve_index++;
+        }
+      }
+    } else {
+      p_dst[i] = pU->enve_mag_start;
+    }
+  }
+}
+
+// Samples each unit renders between two sums. Keeps the per-unit buffers
+// small for long noises.
+#define _UNIT_SPAN 0x8000
+#define _UNIT_BLOCK 0x100
+
+typedef struct {
+  _UNIT **units;  // enabled units only
+  double *bufs;   // [unit][ch][_UNIT_SPAN]
+  int32_t ch;
+  int32_t smp_num;
+  const short *p_tbl_rand;
+} _SPANTASK;
+
+// Renders [smp_num] samples of one unit into its buffers. The arithmetic is
+// the same, in the same order, as the old one-sample-at-a-time loop.
+static void _Unit_Span(void *user, int32_t index) {
+  const _SPANTASK *task = (const _SPANTASK *)user;
+  _UNIT *pU = task->units[index];
+  double *p_dst = &task->bufs[(size_t)index * task->ch * _UNIT_SPAN];
+
+  double fres[_UNIT_BLOCK];
+  double vols[_UNIT_BLOCK];
+  double works[_UNIT_BLOCK];
+  double envs[_UNIT_BLOCK];
+
+  for (int32_t s = 0; s < task->smp_num; s += _UNIT_BLOCK) {
+    int32_t num = task->smp_num - s;
+    if (num > _UNIT_BLOCK) num = _UNIT_BLOCK;
+
+    _freq_blocks[pU->freq.ran_type](&pU->freq, task->p_tbl_rand, fres, num);
+    _volu_blocks[pU->volu.ran_type](&pU->volu, task->p_tbl_rand, vols, num);
+    _main_blocks[pU->main.ran_type](&pU->main, task->p_tbl_rand, fres, works,
+                                    num);
+    _Envelope_Block(pU, envs, num);
+
+    for (int32_t i = 0; i < num; i++) {
+      double work = works[i] * (vols[i] + _SAMPLING_TOP) / (_SAMPLING_TOP * 2);
+      for (int32_t c = 0; c < task->ch; c++)
+        p_dst[c * _UNIT_SPAN + s + i] = work * pU->pan[c] * envs[i];
+    }
+  }
+}
+
+void pxtnPulse_NoiseBuilder::set_task_runner(pxtnTaskRunner runner,
+                                             void *user) {
+  _task_runner = runner;
+  _task_runner_user = user;
 }
 
 pxtnPulse_PCM *pxtnPulse_NoiseBuilder::BuildNoise(pxtnPulse_Noise *p_noise,
@@ -465,10 +579,6 @@ pxtnPulse_PCM *pxtnPulse_NoiseBuilder::BuildNoise(pxtnPulse_Noise *p_noise,
   if (!_b_init) return NULL;
 
   bool b_ret = false;
-  int32_t offset = 0;
-  double work = 0;
-  double vol = 0;
-  double fre = 0;
   double store = 0;
   int32_t byte4 = 0;
   int32_t unit_num = 0;
@@ -476,13 +586,19 @@ pxtnPulse_PCM *pxtnPulse_NoiseBuilder::BuildNoise(pxtnPulse_Noise *p_noise,
   int32_t smp_num = 0;
 
   _UNIT *units = NULL;
+  _UNIT **enabled = NULL;
+  int32_t enabled_num = 0;
+  double *bufs = NULL;
   pxtnPulse_PCM *p_pcm = NULL;
+  pxtnTaskRunner runner = _task_runner ? _task_runner : pxtnTask_Run_Threads;
 
   p_noise->Fix();
 
   unit_num = p_noise->get_unit_num();
 
   if (!pxtnMem_zero_alloc((void **)&units, sizeof(_UNIT) * unit_num)) goto End;
+  if (!pxtnMem_zero_alloc((void **)&enabled, sizeof(_UNIT *) * unit_num))
+    goto End;
 
   for (int32_t u = 0; u < unit_num; u++) {
     _UNIT *pU = &units[u];
@@ -535,133 +651,43 @@ pxtnPulse_PCM *pxtnPulse_NoiseBuilder::BuildNoise(pxtnPulse_Noise *p_noise,
   if (p_pcm->Create(ch, sps, bps, smp_num) != pxtnOK) goto End;
   p = (unsigned char *)p_pcm->get_p_buf_variable();
 
-  for (int32_t s = 0; s < smp_num; s++) {
-    for (int32_t c = 0; c < ch; c++) {
-      store = 0;
-      for (int32_t u = 0; u < unit_num; u++) {
-        _UNIT *pU = &units[u];
-
-        if (pU->bEnable) {
-          _OSCILLATOR *po;
-
-          // main
-          po = &pU->main;
-          switch (po->ran_type) {
-            case _RANDOM_None:
-              offset = (int32_t)po->offset;
-              if (offset >= 0)
-                work = po->p_smp[offset];
-              else
-                work = 0;
-              break;
-            case _RANDOM_Saw:
-              if (po->offset >= 0)
-                work = po->rdm_start +
-                       po->rdm_margin * (int32_t)po->offset / _smp_num;
-              else
-                work = 0;
-              break;
-            case _RANDOM_Rect:
-              if (po->offset >= 0)
-                work = po->rdm_start;
-              else
-                work = 0;
-              break;
-          }
-          if (po->bReverse) work *= -1;
-          work *= po->volume;
-
-          // volu
-          po = &pU->volu;
-          switch (po->ran_type) {
-            case _RANDOM_None:
-              offset = (int32_t)po->offset;
-              vol = (double)po->p_smp[offset];
-              break;
-            case _RANDOM_Saw:
-              vol = po->rdm_start +
-                    po->rdm_margin * (int32_t)po->offset / _smp_num;
-              break;
-            case _RANDOM_Rect:
-              vol = po->rdm_start;
-              break;
-          }
-          if (po->bReverse) vol *= -1;
-          vol *= po->volume;
-
-          work = work * (vol + _SAMPLING_TOP) / (_SAMPLING_TOP * 2);
-          work = work * pU->pan[c];
-
-          // envelope
-          if (pU->enve_index < pU->enve_num)
-            work *= pU->enve_mag_start + (pU->enve_mag_margin * pU->enve_count /
-                                          pU->enves[pU->enve_index].smp);
-          else
-            work *= pU->enve_mag_start;
-          store += work;
-        }
-      }
-
-      byte4 = (int32_t)store;
-      if (byte4 > _SAMPLING_TOP) byte4 = _SAMPLING_TOP;
-      if (byte4 < -_SAMPLING_TOP) byte4 = -_SAMPLING_TOP;
-      if (bps == 8) {
-        *p = (unsigned char)((byte4 >> 8) + 128);
-        p += 1;
-      }  //  8bit
-      else {
-        *((short *)p) = (short)byte4;
-        p += 2;
-      }  // 16bit
-    }
-
-    // incriment
-    for (int32_t u = 0; u < unit_num; u++) {
-      _UNIT *pU = &units[u];
-
-      if (pU->bEnable) {
-        _OSCILLATOR *po = &pU->freq;
-
-        switch (po->ran_type) {
-          case _RANDOM_None:
-            offset = (int32_t)po->offset;
-            fre = _KEY_TOP * po->p_smp[offset] / _SAMPLING_TOP;
-            break;
-          case _RANDOM_Saw:
-            fre =
-                po->rdm_start + po->rdm_margin * (int32_t)po->offset / _smp_num;
-            break;
-          case _RANDOM_Rect:
-            fre = po->rdm_start;
-            break;
-        }
-
-        if (po->bReverse) fre *= -1;
-        fre *= po->volume;
-
-        _incriment(&pU->main,
-                   pU->main.incriment * pxtnPulse_Frequency::Get((int32_t)fre),
-                   _p_tables[pxWAVETYPE_Random]);
-        _incriment(&pU->freq, pU->freq.incriment, _p_tables[pxWAVETYPE_Random]);
-        _incriment(&pU->volu, pU->volu.incriment, _p_tables[pxWAVETYPE_Random]);
-
-        // envelope
-        if (pU->enve_index < pU->enve_num) {
-          pU->enve_count++;
-          if (pU->enve_count >= pU->enves[pU->enve_index].smp) {
-            pU->enve_count = 0;
-            pU->enve_mag_start = pU->enves[pU->enve_index].mag;
-            pU->enve_mag_margin = 0;
-            pU->enve_index++;
-            while (pU->enve_index < pU->enve_num) {
-              pU->enve_mag_margin =
-                  pU->enves[pU->enve_index].mag - pU->enve_mag_start;
-              if (pU->enves[pU->enve_index].smp) break;
-              pU->enve_mag_start = pU->enves[pU->enve_index].mag;
-              pU->enve_index++;
-            }
-          }
-        }
+  for (int32_t u = 0; u < unit_num; u++) {
+    if (units[u].bEnable) enabled[enabled_num++] = &units[u];
+  }
+  if (enabled_num) {
+    size_t size = sizeof(double) * enabled_num * ch * _UNIT_SPAN;
+    if (!pxtnMem_zero_alloc((void **)&bufs, size)) goto End;
+  }
+
+  // Units are rendered independently (in parallel when a runner allows), then
+  // summed in unit order so the result doesn't depend on scheduling.
+  for (int32_t s = 0; s < smp_num; s += _UNIT_SPAN) {
+    _SPANTASK task;
+    task.units = enabled;
+    task.bufs = bufs;
+    task.ch = ch;
+    task.smp_num = smp_num - s;
+    if (task.smp_num > _UNIT_SPAN) task.smp_num = _UNIT_SPAN;
+    task.p_tbl_rand = _p_tables[pxWAVETYPE_Random];
+    runner(_task_runner_user, _Unit_Span, &task, enabled_num);
+
+    for (int32_t i = 0; i < task.smp_num; i++) {
+      for (int32_t c = 0; c < ch; c++) {
+        store = 0;
+        for (int32_t u = 0; u < enabled_num; u++)
+          store += bufs[((size_t)u * ch + c) * _UNIT_SPAN + i];
+
+        byte4 = (int32_t)store;
+        if (byte4 > _SAMPLING_TOP) byte4 = _SAMPLING_TOP;
+        if (byte4 < -_SAMPLING_TOP) byte4 = -_SAMPLING_TOP;
+        if (bps == 8) {
+          *p = (unsigned char)((byte4 >> 8) + 128);
+          p += 1;
+        }  //  8bit
+        else {
+          *((short *)p) = (short)byte4;
+          p += 2;
+        }  // 16bit
       }
     }
   }
@@ -672,6 +698,8 @@ End:
     for (int i = 0; i < unit_num; i++) pxtnMem_free((void **)&units[i].enves);
     pxtnMem_free((void **)&units);
   }
+  pxtnMem_free((void **)&enabled);
+  pxtnMem_free((void **)&bufs);
 
   if (!b_ret && p_pcm) SAFE_DELETE(p_pcm);
 
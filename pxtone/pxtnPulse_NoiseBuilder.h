@@ -3,6 +3,7 @@
 
 #include "./pxtn.h"
 #include "./pxtnPulse_Noise.h"
+#include "./pxtnTask.h"
 
 class pxtnPulse_NoiseBuilder {
  private:
@@ -10,11 +11,10 @@ class pxtnPulse_NoiseBuilder {
   pxtnPulse_NoiseBuilder(const pxtnPulse_NoiseBuilder& src) = delete;
 
   bool _b_init;
-  short* _p_tables[pxWAVETYPE_num];
-  int32_t _rand_buf[2];
+  const short* const* _p_tables;  // shared by every builder, never written
 
-  void _random_reset();
-  short _random_get();
+  pxtnTaskRunner _task_runner;
+  void* _task_runner_user;
 
  public:
   pxtnPulse_NoiseBuilder();
@@ -22,6 +22,10 @@ class pxtnPulse_NoiseBuilder {
 
   bool Init();
 
+  // Runner for the noise units of one BuildNoise. NULL (the default) uses
+  // pxtnTask_Run_Threads.
+  void set_task_runner(pxtnTaskRunner runner, void* user);
+
   pxtnPulse_PCM* BuildNoise(pxtnPulse_Noise* p_noise, int32_t ch, int32_t sps,
                             int32_t bps) const;
 };
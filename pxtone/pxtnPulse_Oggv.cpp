@@ -270,6 +270,11 @@ int32_t pxtnPulse_Oggv::GetSize() const {
   return sizeof(int32_t) * 4 + _size;
 }
 
+const char* pxtnPulse_Oggv::get_p_data(int32_t* p_size) const {
+  if (p_size) *p_size = _p_data ? _size : 0;
+  return _p_data;
+}
+
 bool pxtnPulse_Oggv::ogg_write(pxtnDescriptor* desc) const {
   bool b_ret = false;
 
@@ -28,6 +28,8 @@ class pxtnPulse_Oggv {
   void Release();
   bool GetInfo(int* p_ch, int* p_sps, int* p_smp_num);
   int32_t GetSize() const;
+  // The Ogg Vorbis stream as stored in the song.
+  const char* get_p_data(int32_t* p_size) const;
 
   bool ogg_write(pxtnDescriptor* p_doc) const;
   pxtnERR ogg_read(pxtnDescriptor* p_doc);
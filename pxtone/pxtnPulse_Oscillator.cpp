@@ -3,6 +3,8 @@
 
 #include "./pxtn.h"
 
+#include <vector>
+
 pxtnPulse_Oscillator::pxtnPulse_Oscillator() {
   _volume = 0;
   _p_point = NULL;
@@ -83,4 +85,68 @@ double pxtnPulse_Oscillator::GetOneSample_Coodinate(int32_t index) {
     work = y1;
 
   return work * _volume / 128 / 128;
-}
\ No newline at end of file
+}
+void pxtnPulse_Oscillator::GetSamples_Overtone(double *p_dst) const {
+  if (_sample_num <= 0) return;
+
+  double pi = 3.1415926535897932;
+  std::vector<double> sines(_sample_num);
+  for (int32_t s = 0; s < _sample_num; s++)
+    sines[s] = sin(2 * pi * s / _sample_num);
+
+  for (int32_t s = 0; s < _sample_num; s++) p_dst[s] = 0;
+  for (int32_t o = 0; o < _point_num; o++) {
+    int32_t x = _p_point[o].x;
+    double y = _p_point[o].y;
+    // phase of overtone x at sample s is x * s (mod sample_num)
+    int32_t step = x % _sample_num;
+    if (step < 0) step += _sample_num;
+    int32_t phase = 0;
+    for (int32_t s = 0; s < _sample_num; s++) {
+      p_dst[s] += sines[phase] * y / x / 128;
+      phase += step;
+      if (phase >= _sample_num) phase -= _sample_num;
+    }
+  }
+  for (int32_t s = 0; s < _sample_num; s++)
+    p_dst[s] = p_dst[s] * _volume / 128;
+}
+
+void pxtnPulse_Oscillator::GetSamples_Coodinate(double *p_dst) const {
+  // The first point past i only moves forward as i grows, so the search
+  // resumes where the previous sample left off.
+  int32_t c = 0;
+  for (int32_t s = 0; s < _sample_num; s++) {
+    int32_t i = _point_reso * s / _sample_num;
+    while (c < _point_num && _p_point[c].x <= i) c++;
+
+    int32_t x1, y1, x2, y2;
+    if (c == _point_num) {
+      x1 = _p_point[c - 1].x;
+      y1 = _p_point[c - 1].y;
+      x2 = _point_reso;
+      y2 = _p_point[0].y;
+    } else if (c) {
+      x1 = _p_point[c - 1].x;
+      y1 = _p_point[c - 1].y;
+      x2 = _p_point[c].x;
+      y2 = _p_point[c].y;
+    } else {
+      x1 = _p_point[0].x;
+      y1 = _p_point[0].y;
+      x2 = _p_point[0].x;
+      y2 = _p_point[0].y;
+    }
+
+    int32_t w = x2 - x1;
+    int32_t d = i - x1;
+    int32_t h = y2 - y1;
+    double work;
+    if (d)
+      work = (double)y1 + (double)h * (double)d / (double)w;
+    else
+      work = y1;
+
+    p_dst[s] = work * _volume / 128 / 128;
+  }
+}
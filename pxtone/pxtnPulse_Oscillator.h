@@ -21,6 +21,13 @@ class pxtnPulse_Oscillator {
                       int32_t sample_num, int32_t point_reso);
   double GetOneSample_Overtone(int32_t index);
   double GetOneSample_Coodinate(int32_t index);
+
+  // Fill all [sample_num] samples in one pass. The overtone one reads a sine
+  // table of [sample_num] entries instead of calling sin() per point and
+  // sample, so it can differ from GetOneSample_Overtone in the last bits. The
+  // coodinate one gives exactly the same values.
+  void GetSamples_Overtone(double* p_dst) const;
+  void GetSamples_Coodinate(double* p_dst) const;
 };
 
 #endif
@@ -545,11 +545,104 @@ End:
   return b_ret;
 }
 
+// sps, band-limited. Sizes come out the same as with the nearest conversion.
+bool pxtnPulse_PCM::_Convert_SamplePerSecond_Sinc(int32_t new_sps,
+                                                  bool b_loop) {
+  bool b_ret = false;
+  int32_t frame_size;
+  int32_t src_num, dst_num;
+  int32_t head_num, body_num, tail_num;
+
+  float *p_src = NULL;
+  float *p_dst = NULL;
+  uint8_t *p_work = NULL;
+
+  if (!_p_smp) return false;
+  if (_sps == new_sps) return true;
+  if (_bps != 8 && _bps != 16) return false;
+
+  frame_size = _ch * _bps / 8;
+  head_num = Convert_SampleNum(_smp_head, frame_size, _sps, new_sps);
+  body_num = Convert_SampleNum(_smp_body, frame_size, _sps, new_sps);
+  tail_num = Convert_SampleNum(_smp_tail, frame_size, _sps, new_sps);
+  src_num = _smp_head + _smp_body + _smp_tail;
+  dst_num = head_num + body_num + tail_num;
+
+  if (!pxtnMem_zero_alloc((void **)&p_src, src_num * sizeof(float) + 1))
+    goto End;
+  if (!pxtnMem_zero_alloc((void **)&p_dst, dst_num * sizeof(float) + 1))
+    goto End;
+  if (!pxtnMem_zero_alloc((void **)&p_work, dst_num * frame_size + 1))
+    goto End;
+
+  for (int32_t c = 0; c < _ch; c++) {
+    if (_bps == 8) {
+      for (int32_t i = 0; i < src_num; i++)
+        p_src[i] = (float)((int32_t)_p_smp[i * _ch + c] - 128);
+    } else {
+      const int16_t *p16 = (const int16_t *)_p_smp;
+      for (int32_t i = 0; i < src_num; i++) p_src[i] = p16[i * _ch + c];
+    }
+
+    if (!pxtnResample_Sinc(p_src, src_num, _sps, p_dst, dst_num, new_sps,
+                           b_loop))
+      goto End;
+
+    int32_t top = (_bps == 8) ? 127 : 32767;
+    for (int32_t a = 0; a < dst_num; a++) {
+      int32_t v = (int32_t)floorf(p_dst[a] + 0.5f);
+      if (v > top) v = top;
+      if (v < -top - 1) v = -top - 1;
+      if (_bps == 8)
+        p_work[a * _ch + c] = (uint8_t)(v + 128);
+      else
+        ((int16_t *)p_work)[a * _ch + c] = (int16_t)v;
+    }
+  }
+
+  pxtnMem_free((void **)&_p_smp);
+  _p_smp = p_work;
+  p_work = NULL;
+  _smp_head = head_num;
+  _smp_body = body_num;
+  _smp_tail = tail_num;
+  _sps = new_sps;
+
+  b_ret = true;
+End:
+
+  if (!b_ret) {
+    pxtnMem_free((void **)&_p_smp);
+    _smp_head = 0;
+    _smp_body = 0;
+    _smp_tail = 0;
+  }
+
+  pxtnMem_free((void **)&p_work);
+  pxtnMem_free((void **)&p_dst);
+  pxtnMem_free((void **)&p_src);
+
+  return b_ret;
+}
+
+int32_t pxtnPulse_PCM::Convert_SampleNum(int32_t smp_num, int32_t frame_size,
+                                         int32_t sps, int32_t new_sps) {
+  if (sps == new_sps) return smp_num;
+  int32_t size = smp_num * frame_size;
+  size = (int32_t)(((double)size * (double)new_sps + (double)(sps)-1) / sps);
+  return size / frame_size;
+}
+
 // convert..
-bool pxtnPulse_PCM::Convert(int32_t new_ch, int32_t new_sps, int32_t new_bps) {
+bool pxtnPulse_PCM::Convert(int32_t new_ch, int32_t new_sps, int32_t new_bps,
+                            pxtnRESAMPLE resample, bool b_loop) {
   if (!_Convert_ChannelNum(new_ch)) return false;
   if (!_Convert_BitPerSample(new_bps)) return false;
-  if (!_Convert_SamplePerSecond(new_sps)) return false;
+  if (resample == pxtnRESAMPLE_sinc) {
+    if (!_Convert_SamplePerSecond_Sinc(new_sps, b_loop)) return false;
+  } else {
+    if (!_Convert_SamplePerSecond(new_sps)) return false;
+  }
 
   return true;
 }
@@ -3,6 +3,7 @@
 
 #include "./pxtn.h"
 #include "./pxtnDescriptor.h"
+#include "./pxtnResample.h"
 
 class pxtnPulse_PCM {
  private:
@@ -20,6 +21,7 @@ class pxtnPulse_PCM {
   bool _Convert_ChannelNum(int32_t new_ch);
   bool _Convert_BitPerSample(int32_t new_bps);
   bool _Convert_SamplePerSecond(int32_t new_sps);
+  bool _Convert_SamplePerSecond_Sinc(int32_t new_sps, bool b_loop);
 
  public:
   pxtnPulse_PCM();
@@ -31,8 +33,16 @@ class pxtnPulse_PCM {
   pxtnERR read(pxtnDescriptor *doc, uint32_t *basic_key);
   bool write(pxtnDescriptor *doc, const char *pstrLIST) const;
 
-  bool Convert(int32_t new_ch, int32_t new_sps, int32_t new_bps);
+  // [b_loop]: the sample is played as a loop, so [resample] may treat it as
+  // periodic at the edges.
+  bool Convert(int32_t new_ch, int32_t new_sps, int32_t new_bps,
+               pxtnRESAMPLE resample = pxtnRESAMPLE_nearest,
+               bool b_loop = false);
   bool Convert_Volume(float v);
+  // Frames [smp_num] frames of [frame_size] bytes come to when converted from
+  // [sps] to [new_sps], rounded the way Convert rounds them.
+  static int32_t Convert_SampleNum(int32_t smp_num, int32_t frame_size,
+                                   int32_t sps, int32_t new_sps);
   pxtnERR Copy(pxtnPulse_PCM *p_dst) const;
   bool Copy_(pxtnPulse_PCM *p_dst, int32_t start, int32_t end) const;
 
@@ -0,0 +1,173 @@
+#include "./pxtnResample.h"
+
+#include <math.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "./pxtnMix.h"
+
+#define _ZERO_CROSSINGS 16     // on each side, at the cutoff
+#define _CUTOFF 0.95           // of the lower nyquist, leaves room for the
+                               // transition band
+#define _KAISER_BETA 8.6       // about -85dB stopband
+#define _PHASE_MAX 1024        // more phases are interpolated between rows
+#define _BANK_CACHE_MAX 16
+#define _PI 3.1415926535897932
+
+namespace {
+
+// Row p holds the taps for an output sample at fraction p / phase_num past an
+// input sample. Rows are exact when every fraction the ratio can produce has
+// its own row (b_exact); otherwise there is one more row for fraction 1 and
+// neighbouring rows are blended.
+struct _BANK {
+  int32_t L;  // dst_sps / gcd
+  int32_t M;  // src_sps / gcd
+  int32_t half;
+  int32_t tap_num;
+  int32_t phase_num;
+  bool b_exact;
+  std::vector<float> coefs;
+};
+
+}  // namespace
+
+static int32_t _Gcd(int32_t a, int32_t b) {
+  while (b) {
+    int32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static double _Bessel_I0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  double q = x * x / 4.0;
+  for (int32_t k = 1; k < 64; k++) {
+    term *= q / ((double)k * k);
+    sum += term;
+    if (term < sum * 1e-17) break;
+  }
+  return sum;
+}
+
+static void _Build_Row(float* p_row, int32_t half, int32_t tap_num, double fc,
+                       double frac) {
+  double i0_beta = _Bessel_I0(_KAISER_BETA);
+  double sum = 0;
+  std::vector<double> taps(tap_num);
+  for (int32_t k = 0; k < tap_num; k++) {
+    double d = (double)(k - (half - 1)) - frac;
+    double x = d / half;
+    double w = 0;
+    if (x > -1.0 && x < 1.0)
+      w = _Bessel_I0(_KAISER_BETA * sqrt(1.0 - x * x)) / i0_beta;
+    double t = fc * d * _PI;
+    double s = (t == 0) ? 1.0 : sin(t) / t;
+    taps[k] = fc * s * w;
+    sum += taps[k];
+  }
+  // unity gain at DC for every phase, or a DC offset turns into a whine.
+  for (int32_t k = 0; k < tap_num; k++) p_row[k] = (float)(taps[k] / sum);
+}
+
+static std::shared_ptr<const _BANK> _Build_Bank(int32_t L, int32_t M) {
+  std::shared_ptr<_BANK> p_bank = std::make_shared<_BANK>();
+  double fc = _CUTOFF;
+  if (L < M) fc *= (double)L / M;
+
+  p_bank->L = L;
+  p_bank->M = M;
+  p_bank->half = (int32_t)ceil(_ZERO_CROSSINGS / fc);
+  p_bank->tap_num = p_bank->half * 2;
+  p_bank->b_exact = (L <= _PHASE_MAX);
+  p_bank->phase_num = p_bank->b_exact ? L : _PHASE_MAX;
+
+  int32_t row_num = p_bank->phase_num + (p_bank->b_exact ? 0 : 1);
+  p_bank->coefs.resize((size_t)row_num * p_bank->tap_num);
+  for (int32_t p = 0; p < row_num; p++) {
+    _Build_Row(&p_bank->coefs[(size_t)p * p_bank->tap_num], p_bank->half,
+               p_bank->tap_num, fc, (double)p / p_bank->phase_num);
+  }
+  return p_bank;
+}
+
+// Banks only depend on the ratio, and a song's samples share a few of them.
+static std::shared_ptr<const _BANK> _Bank(int32_t L, int32_t M) {
+  static std::mutex mtx;
+  static std::map<int64_t, std::shared_ptr<const _BANK>> banks;
+
+  int64_t key = ((int64_t)L << 32) | (uint32_t)M;
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = banks.find(key);
+  if (it != banks.end()) return it->second;
+  if (banks.size() >= _BANK_CACHE_MAX) banks.clear();
+  std::shared_ptr<const _BANK> p_bank = _Build_Bank(L, M);
+  banks[key] = p_bank;
+  return p_bank;
+}
+
+bool pxtnResample_Sinc(const float* p_src, int32_t src_num, int32_t src_sps,
+                       float* p_dst, int32_t dst_num, int32_t dst_sps,
+                       bool b_loop) {
+  if (src_sps <= 0 || dst_sps <= 0 || src_num < 0 || dst_num < 0) return false;
+  if (!dst_num) return true;
+  if (!src_num) {
+    for (int32_t a = 0; a < dst_num; a++) p_dst[a] = 0;
+    return true;
+  }
+
+  int32_t g = _Gcd(dst_sps, src_sps);
+  std::shared_ptr<const _BANK> p_bank = _Bank(dst_sps / g, src_sps / g);
+  const int32_t L = p_bank->L;
+  const int32_t M = p_bank->M;
+  const int32_t half = p_bank->half;
+  const int32_t tap_num = p_bank->tap_num;
+
+  // the input with [half] samples of context on both sides, so the inner loop
+  // needn't care about edges. Output sizes are rounded up, so the last output
+  // may start past the last input.
+  int64_t last = (int64_t)(dst_num - 1) * M / L;
+  int64_t body = last + 1 > src_num ? last + 1 : src_num;
+  std::vector<float> padded((size_t)(body + 2 * half));
+  for (int64_t j = 0; j < (int64_t)padded.size(); j++) {
+    int64_t idx = j - half;
+    if (b_loop) {
+      idx %= src_num;
+      if (idx < 0) idx += src_num;
+      padded[j] = p_src[idx];
+    } else {
+      padded[j] = (idx >= 0 && idx < src_num) ? p_src[idx] : 0;
+    }
+  }
+
+  std::vector<float> blend;
+  if (!p_bank->b_exact) blend.resize(tap_num);
+
+  for (int32_t a = 0; a < dst_num; a++) {
+    int64_t pos = (int64_t)a * M;
+    int64_t i = pos / L;
+    int64_t r = pos % L;
+    const float* p_in = &padded[(size_t)(i + 1)];
+    const float* p_row;
+    if (p_bank->b_exact) {
+      p_row = &p_bank->coefs[(size_t)r * tap_num];
+    } else {
+      double fp = (double)r * p_bank->phase_num / L;
+      int32_t k = (int32_t)fp;
+      float t = (float)(fp - k);
+      const float* p0 = &p_bank->coefs[(size_t)k * tap_num];
+      const float* p1 = p0 + tap_num;
+      for (int32_t n = 0; n < tap_num; n++)
+        blend[n] = p0[n] + (p1[n] - p0[n]) * t;
+      p_row = blend.data();
+    }
+    p_dst[a] = pxtnMix_Dot(p_in, p_row, tap_num);
+  }
+  return true;
+}
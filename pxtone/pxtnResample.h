@@ -0,0 +1,25 @@
+// pxtnResample: band-limited sample rate conversion for PCM voices.
+
+#ifndef pxtnResample_H
+#define pxtnResample_H
+
+#include "./pxtn.h"
+
+enum pxtnRESAMPLE : int8_t {
+  // pxtone's own conversion: each output sample copies the nearest earlier
+  // input sample. Cheap, but aliases and adds a metallic edge to samples that
+  // aren't already at the output rate.
+  pxtnRESAMPLE_nearest = 0,
+  // Kaiser-windowed sinc through a polyphase filter bank.
+  pxtnRESAMPLE_sinc,
+};
+
+// Converts [src_num] samples at [src_sps] to [dst_num] samples at [dst_sps].
+// Output sample a sits at input position a * src_sps / dst_sps, as with the
+// nearest conversion. With [b_loop] the input is treated as periodic, so loop
+// points stay seamless; otherwise it is zero outside [0, src_num).
+bool pxtnResample_Sinc(const float* p_src, int32_t src_num, int32_t src_sps,
+                       float* p_dst, int32_t dst_num, int32_t dst_sps,
+                       bool b_loop);
+
+#endif
@@ -9,6 +9,8 @@
 #include "./pxtnService.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 
 #include "./pxtn.h"
 
@@ -54,6 +56,9 @@ static const char *_code_assiUNIT = "assiUNIT";
 static const char *_code_assiWOIC = "assiWOIC";
 static const char *_code_pxtoneND = "pxtoneND";
 
+static const char *_code_tones_v1 = "PTTONES---261017";
+static const char *_code_tonesEND = "tonesEND";
+
 enum _enum_Tag : int8_t {
   _TAG_Unknown = 0,
   _TAG_antiOPER,
@@ -102,7 +107,14 @@ pxtnService::pxtnService() {
 
   _ptn_bldr = NULL;
 
+  _moo_version = 0;
+
   _sampled_proc = NULL;
+  _task_runner = NULL;
+  _task_runner_user = NULL;
+  _resample = pxtnRESAMPLE_nearest;
+  _b_lazy_tones = false;
+  _lazy_lead_sec = 0;
   _sampled_user = NULL;
 }
 
@@ -113,6 +125,7 @@ bool pxtnService::_release() {
   SAFE_DELETE(text);
   SAFE_DELETE(master);
   SAFE_DELETE(evels);
+  _p_pending.reset();
   SAFE_DELETE(_ptn_bldr);
   _delays.clear();
   _ovdrvs.clear();
@@ -214,24 +227,250 @@ bool pxtnService::AdjustMeasNum() {
 
 int32_t pxtnService::Group_Num() const { return _b_init ? _group_num : 0; }
 
-pxtnERR pxtnService::tones_ready(mooState &moo_state) {
+typedef struct {
+  std::shared_ptr<pxtnWoice> *woices;
+  const pxtnPulse_NoiseBuilder *ptn_bldr;
+  int32_t sps;
+  pxtnRESAMPLE resample;
+  pxtnERR *results;
+} _TONEREADYTASK;
+
+static void _Tone_Ready_Task(void *user, int32_t index) {
+  _TONEREADYTASK *task = (_TONEREADYTASK *)user;
+  task->results[index] = task->woices[index]->Tone_Ready(
+      task->ptn_bldr, task->sps, task->resample);
+}
+
+enum _PENDINGSTATE : int8_t {
+  _PENDING_wait = 0,
+  _PENDING_busy,
+  _PENDING_done,
+};
+
+struct pxtnWOICEPENDING {
+  std::mutex mtx;
+  std::condition_variable cv;
+  // In order of first note; woices[played_num..] are never played.
+  std::vector<std::shared_ptr<pxtnWoice>> woices;
+  std::vector<_PENDINGSTATE> states;
+  int32_t played_num;
+  const pxtnPulse_NoiseBuilder *ptn_bldr;
+  int32_t sps;
+  pxtnRESAMPLE resample;
+};
+
+// Readies woices[i] unless someone else has; with [b_wait], also waits for
+// whoever is at it.
+static pxtnERR _Pending_Ready(pxtnWOICEPENDING *p, int32_t i, bool b_wait) {
+  std::unique_lock<std::mutex> lock(p->mtx);
+  if (p->states[i] == _PENDING_busy) {
+    if (b_wait)
+      p->cv.wait(lock, [&] { return p->states[i] == _PENDING_done; });
+    return pxtnOK;
+  }
+  if (p->states[i] == _PENDING_done) return pxtnOK;
+  p->states[i] = _PENDING_busy;
+  lock.unlock();
+
+  pxtnERR res = p->woices[i]->Tone_Ready(p->ptn_bldr, p->sps, p->resample);
+
+  lock.lock();
+  p->states[i] = _PENDING_done;
+  p->cv.notify_all();
+  return res;
+}
+
+void pxtnService::_woice_first_clocks(std::vector<int32_t> &clocks) const {
+  clocks.assign(_woice_num, -1);
+  std::vector<int32_t> unit_woices(_unit_num, EVENTDEFAULT_VOICENO);
+  for (const pxtnMOOEVENT &e : _moo_events) {
+    if (e.unit_no >= _unit_num) continue;
+    if (e.kind == EVENTKIND_VOICENO) {
+      // as set_woice does, a woice that doesn't exist leaves the unit's.
+      int32_t w = e.value >= 0 ? e.value : -e.value - 1;
+      if (w < _woice_num) unit_woices[e.unit_no] = w;
+    } else if (e.kind == EVENTKIND_ON) {
+      int32_t w = unit_woices[e.unit_no];
+      if (w < _woice_num && clocks[w] < 0) clocks[w] = e.clock;
+    }
+  }
+}
+
+pxtnERR pxtnService::tones_ready() {
+  if (!_b_init) return pxtnERR_INIT;
+
+  pxtnERR res = moo_events_ready();
+  if (res != pxtnOK) return res;
+
+  _p_pending.reset();
+  std::vector<std::shared_ptr<pxtnWoice>> woices(_woices,
+                                                 _woices + _woice_num);
+  if (_b_lazy_tones) {
+    std::vector<int32_t> clocks;
+    _woice_first_clocks(clocks);
+    int32_t lead_clock = (int32_t)(_lazy_lead_sec * master->get_beat_tempo() *
+                                   master->get_beat_clock() / 60);
+
+    std::vector<int32_t> order(_woice_num);
+    for (int32_t i = 0; i < _woice_num; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+      if ((clocks[a] < 0) != (clocks[b] < 0)) return clocks[b] < 0;
+      return clocks[a] < clocks[b];
+    });
+
+    std::shared_ptr<pxtnWOICEPENDING> p_pending =
+        std::make_shared<pxtnWOICEPENDING>();
+    p_pending->played_num = 0;
+    p_pending->ptn_bldr = _ptn_bldr;
+    p_pending->sps = _dst_sps;
+    p_pending->resample = _resample;
+    woices.clear();
+    for (int32_t i : order) {
+      if (clocks[i] >= 0 && clocks[i] <= lead_clock) {
+        woices.push_back(_woices[i]);
+        continue;
+      }
+      if (clocks[i] >= 0) p_pending->played_num++;
+      p_pending->woices.push_back(_woices[i]);
+      p_pending->states.push_back(_PENDING_wait);
+    }
+    if (!p_pending->woices.empty()) _p_pending = p_pending;
+  }
+
+  // Woices don't share anything but the (read-only) noise builder, so they
+  // are readied in parallel. The first failure by woice order is returned, as
+  // the serial loop did.
+  int32_t num = (int32_t)woices.size();
+  std::vector<pxtnERR> results(num, pxtnOK);
+  _TONEREADYTASK task = {woices.data(), _ptn_bldr, _dst_sps, _resample,
+                         results.data()};
+  pxtnTaskRunner runner = _task_runner ? _task_runner : pxtnTask_Run_Threads;
+  runner(_task_runner_user, _Tone_Ready_Task, &task, num);
+
+  for (int32_t i = 0; i < num; i++) {
+    if (results[i] != pxtnOK) return results[i];
+  }
+  return pxtnOK;
+}
+
+pxtnERR pxtnService::tones_ready_pending() const {
+  std::shared_ptr<pxtnWOICEPENDING> p_pending = _p_pending;
+  if (!p_pending) return pxtnOK;
+
+  pxtnERR res = pxtnOK;
+  for (int32_t i = 0; i < p_pending->played_num; i++) {
+    pxtnERR r = _Pending_Ready(p_pending.get(), i, false);
+    if (res == pxtnOK) res = r;
+  }
+  return res;
+}
+
+pxtnERR pxtnService::tones_write(pxtnDescriptor *p_doc) const {
   if (!_b_init) return pxtnERR_INIT;
 
+  for (int32_t w = 0; w < _woice_num; w++) {
+    Woice_ReadyPending(_woices[w].get());
+    if (!_woices[w]->is_tone_ready()) return pxtnERR_INIT;
+  }
+
+  int32_t resample = _resample;
+  if (!p_doc->w_asfile(_code_tones_v1, 1, _VERSIONSIZE)) return pxtnERR_desc_w;
+  if (!p_doc->w_asfile(&_dst_sps, sizeof(int32_t), 1)) return pxtnERR_desc_w;
+  if (!p_doc->w_asfile(&resample, sizeof(int32_t), 1)) return pxtnERR_desc_w;
+  if (!p_doc->w_asfile(&_woice_num, sizeof(int32_t), 1)) return pxtnERR_desc_w;
+  for (int32_t w = 0; w < _woice_num; w++) {
+    if (!_woices[w]->Tone_Write(p_doc)) return pxtnERR_desc_w;
+  }
+  if (!p_doc->w_asfile(_code_tonesEND, 1, _CODESIZE)) return pxtnERR_desc_w;
+  return pxtnOK;
+}
+
+pxtnERR pxtnService::tones_read(pxtnDescriptor *p_doc) {
+  if (!_b_init) return pxtnERR_INIT;
+
+  char code[_VERSIONSIZE] = {};
+  int32_t sps = 0;
+  int32_t resample = 0;
+  int32_t woice_num = 0;
   pxtnERR res = pxtnERR_VOID;
+
+  if (!p_doc->r(code, _VERSIONSIZE, 1)) return pxtnERR_desc_r;
+  if (memcmp(code, _code_tones_v1, _VERSIONSIZE)) return pxtnERR_inv_code;
+  if (!p_doc->r(&sps, sizeof(int32_t), 1)) return pxtnERR_desc_r;
+  if (!p_doc->r(&resample, sizeof(int32_t), 1)) return pxtnERR_desc_r;
+  if (!p_doc->r(&woice_num, sizeof(int32_t), 1)) return pxtnERR_desc_r;
+  if (sps != _dst_sps || resample != _resample || woice_num != _woice_num)
+    return pxtnERR_inv_data;
+
+  res = moo_events_ready();
+  if (res != pxtnOK) return res;
+  _p_pending.reset();
+
+  for (int32_t w = 0; w < _woice_num; w++) {
+    res = _woices[w]->Tone_Read(p_doc, _dst_sps, _resample);
+    if (res != pxtnOK) return res;
+  }
+  if (!p_doc->r(code, _CODESIZE, 1)) return pxtnERR_desc_r;
+  if (memcmp(code, _code_tonesEND, _CODESIZE)) return pxtnERR_inv_code;
+  return pxtnOK;
+}
+
+void pxtnService::Woice_ReadyPending(const pxtnWoice *p_woice) const {
+  std::shared_ptr<pxtnWOICEPENDING> p_pending = _p_pending;
+  if (!p_pending || !p_woice) return;
+
+  for (int32_t i = 0; i < (int32_t)p_pending->woices.size(); i++) {
+    if (p_pending->woices[i].get() != p_woice) continue;
+    _Pending_Ready(p_pending.get(), i, true);
+    return;
+  }
+}
+
+pxtnERR pxtnService::moo_events_ready() {
+  if (!_b_init) return pxtnERR_INIT;
+
+  int32_t last_on[0x100];
+  for (int32_t u = 0; u < 0x100; u++) last_on[u] = -1;
+
+  ++_moo_version;
+  _moo_events.clear();
+  _moo_events.reserve(evels->get_Count());
+  for (const EVERECORD *p = evels->get_Records(); p; p = p->next) {
+    int32_t index = (int32_t)_moo_events.size();
+    if (p->kind == EVENTKIND_ON) {
+      if (last_on[p->unit_no] >= 0)
+        _moo_events[last_on[p->unit_no]].next_on = index;
+      last_on[p->unit_no] = index;
+    }
+    pxtnMOOEVENT e;
+    e.clock = p->clock;
+    e.value = p->value;
+    e.next_on = -1;
+    e.kind = p->kind;
+    e.unit_no = p->unit_no;
+    _moo_events.push_back(e);
+  }
+  return pxtnOK;
+}
+
+pxtnERR pxtnService::moo_tones_ready(mooState &moo_state) const {
+  if (!_b_init) return pxtnERR_INIT;
+
   int32_t beat_num = master->get_beat_num();
   float beat_tempo = master->get_beat_tempo();
 
   moo_state.delays.clear();
   for (size_t i = 0; i < _delays.size(); i++)
     moo_state.delays.emplace_back(_delays[i], beat_num, beat_tempo, _dst_sps);
-
-  for (int32_t i = 0; i < _woice_num; i++) {
-    res = _woices[i]->Tone_Ready(_ptn_bldr, _dst_sps);
-    if (res != pxtnOK) return res;
-  }
   return pxtnOK;
 }
 
+pxtnERR pxtnService::tones_ready(mooState &moo_state) {
+  pxtnERR res = moo_tones_ready(moo_state);
+  if (res != pxtnOK) return res;
+  return tones_ready();
+}
+
 void mooState::tones_clear() {
   for (size_t i = 0; i < delays.size(); i++) delays[i].Tone_Clear();
   for (size_t i = 0; i < units.size(); i++) units[i].Tone_Clear();
@@ -366,6 +605,7 @@ pxtnERR pxtnService::Woice_read(int32_t idx, pxtnDescriptor *desc,
     _woice_num++;
   }
 
+  ++_moo_version;
   pxtnERR res = pxtnERR_VOID;
   res = _woices[idx]->read(desc, type);
   if (res != pxtnOK) {
@@ -376,12 +616,13 @@ pxtnERR pxtnService::Woice_read(int32_t idx, pxtnDescriptor *desc,
 }
 
 pxtnERR pxtnService::Woice_ReadyTone(std::shared_ptr<pxtnWoice> woice) const {
-  return woice->Tone_Ready(_ptn_bldr, _dst_sps);
+  return woice->Tone_Ready(_ptn_bldr, _dst_sps, _resample);
 }
 
 bool pxtnService::Woice_Remove(int32_t idx) {
   if (!_b_init) return false;
   if (idx < 0 || idx >= _woice_num) return false;
+  ++_moo_version;
   _woices[idx].reset();
   _woice_num--;
   for (int32_t i = idx; i < _woice_num; i++) _woices[i] = _woices[i + 1];
@@ -409,6 +650,7 @@ bool pxtnService::Woice_Replace(int32_t old_place, int32_t new_place) {
   }
 
   _woices[new_place] = p_w;
+  ++_moo_version;
   return true;
 }
 
@@ -434,6 +676,7 @@ bool pxtnService::Unit_AddNew() {
   if (_unit_num >= _unit_max) return false;
   _units[_unit_num] = new pxtnUnit();
   _unit_num++;
+  ++_moo_version;
   return true;
 }
 
@@ -444,6 +687,7 @@ bool pxtnService::Unit_Remove(int32_t idx) {
   _unit_num--;
   for (int32_t i = idx; i < _unit_num; i++) _units[i] = _units[i + 1];
   _units[_unit_num] = NULL;
+  ++_moo_version;
 
   return true;
 }
@@ -468,6 +712,7 @@ bool pxtnService::Unit_Replace(int32_t old_place, int32_t new_place,
     }
   }
   _units[new_place] = p_w;
+  ++_moo_version;
 
   // TODO: Perhaps this should just not be part of pxtnService.
   // In the case of adding a unit, we need custom woice setting anyway.
@@ -534,6 +779,29 @@ bool pxtnService::get_byte_per_smp(int32_t *p_byte_per_smp) const {
   return true;
 }
 
+bool pxtnService::set_task_runner(pxtnTaskRunner runner, void *user) {
+  if (!_b_init) return false;
+  _task_runner = runner;
+  _task_runner_user = user;
+  _ptn_bldr->set_task_runner(runner, user);
+  return true;
+}
+
+bool pxtnService::set_resample(pxtnRESAMPLE resample) {
+  if (!_b_init) return false;
+  _resample = resample;
+  return true;
+}
+
+pxtnRESAMPLE pxtnService::get_resample() const { return _resample; }
+
+bool pxtnService::set_lazy_tones(bool b, float lead_sec) {
+  if (!_b_init) return false;
+  _b_lazy_tones = b;
+  _lazy_lead_sec = lead_sec < 0 ? 0 : lead_sec;
+  return true;
+}
+
 bool pxtnService::set_sampled_callback(pxtnSampledCallback proc, void *user) {
   if (!_b_init) return false;
   _sampled_proc = proc;
@@ -600,11 +868,14 @@ bool pxtnService::clear() {
   if (!text->set_comment_buf("", 0)) return false;
 
   evels->Clear();
+  _moo_events.clear();
+  ++_moo_version;
 
   _delays.clear();
   _ovdrvs.clear();
   for (int32_t i = 0; i < _woice_num; i++) _woices[i].reset();
   _woice_num = 0;
+  _p_pending.reset();
   for (int32_t i = 0; i < _unit_num; i++) SAFE_DELETE(_units[i]);
   _unit_num = 0;
 
@@ -1086,12 +1357,13 @@ End:
 // Read Project //////////////
 ////////////////////////////////////////
 
-pxtnERR pxtnService::_ReadTuneItems(pxtnDescriptor *p_doc) {
+pxtnERR pxtnService::_ReadTuneItems(pxtnDescriptor *p_doc, bool b_meta) {
   if (!_b_init) return pxtnERR_INIT;
 
   pxtnERR res = pxtnERR_VOID;
   bool b_end = false;
   char code[_CODESIZE + 1] = {'\0'};
+  int32_t size = 0;
 
   /* Iterates over each of the components of the project - woices, units, etc.
    */
@@ -1103,6 +1375,29 @@ pxtnERR pxtnService::_ReadTuneItems(pxtnDescriptor *p_doc) {
     }
 
     _enum_Tag tag = _CheckTagCode(code);
+    if (b_meta) {
+      // Nothing in these changes the song's timing.
+      switch (tag) {
+        case _TAG_matePCM:
+        case _TAG_matePTV:
+        case _TAG_matePTN:
+        case _TAG_mateOGGV:
+        case _TAG_effeDELA:
+        case _TAG_effeOVER:
+        case _TAG_textNAME:
+        case _TAG_textCOMM:
+        case _TAG_assiWOIC:
+        case _TAG_assiUNIT:
+          if (!p_doc->r(&size, sizeof(int32_t), 1) ||
+              !p_doc->seek(pxtnSEEK_cur, size)) {
+            res = pxtnERR_desc_r;
+            goto term;
+          }
+          continue;
+        default:
+          break;
+      }
+    }
     switch (tag) {
       case _TAG_antiOPER:
         res = pxtnERR_anti_opreation;
@@ -1433,6 +1728,14 @@ term:
 }
 
 pxtnERR pxtnService::read(pxtnDescriptor *p_doc) {
+  return _read(p_doc, false);
+}
+
+pxtnERR pxtnService::read_meta(pxtnDescriptor *p_doc) {
+  return _read(p_doc, true);
+}
+
+pxtnERR pxtnService::_read(pxtnDescriptor *p_doc, bool b_meta) {
   if (!_b_init) return pxtnERR_INIT;
 
   pxtnERR res = pxtnERR_VOID;
@@ -1471,12 +1774,13 @@ pxtnERR pxtnService::read(pxtnDescriptor *p_doc) {
     evels->x4x_Read_Start();
 
   /// the thing that actually reads everything?
-  res = _ReadTuneItems(p_doc);
+  res = _ReadTuneItems(p_doc, b_meta);
   if (res != pxtnOK) goto term;
 
   if (fmt_ver >= _enum_FMTVER_v5) evels->Linear_End(true);
 
-  if (fmt_ver <= _enum_FMTVER_x3x) {
+  // The x3x fixes need the woices and don't move the end of the song.
+  if (fmt_ver <= _enum_FMTVER_x3x && !b_meta) {
     if (!_x3x_TuningKeyEvent()) {
       res = pxtnERR_x3x_key;
       goto term;
@@ -1503,7 +1807,7 @@ pxtnERR pxtnService::read(pxtnDescriptor *p_doc) {
       master->AdjustMeasNum(clock2);
   }
 
-  _moo_b_valid_data = true;
+  _moo_b_valid_data = !b_meta;
   res = pxtnOK;
 term:
 
@@ -12,6 +12,7 @@
 #include "./pxtnMax.h"
 #include "./pxtnOverDrive.h"
 #include "./pxtnPulse_NoiseBuilder.h"
+#include "./pxtnTask.h"
 #include "./pxtnText.h"
 #include "./pxtnUnit.h"
 #include "./pxtnWoice.h"
@@ -21,6 +22,13 @@
 #define pxtnVOMITPREPFLAG_loop 0x01
 #define pxtnVOMITPREPFLAG_unit_mute 0x02
 
+// How Moo_f32 keeps the output in range.
+enum pxtnMOOLIMIT : int8_t {
+  pxtnMOOLIMIT_none = 0,  // no limiting, may exceed 1.0
+  pxtnMOOLIMIT_clamp,     // hard clip like the 16-bit output
+  pxtnMOOLIMIT_soft,      // soft knee above 0.75
+};
+
 typedef struct {
   int32_t start_pos_meas;
   int32_t start_pos_sample;
@@ -35,6 +43,18 @@ typedef struct {
 } pxtnVOMITPREPARATION;
 
 class pxtnService;
+struct pxtnWOICEPENDING;
+
+// An event as the moo loop reads it: the event list flattened into one sorted
+// array, so playback doesn't chase list pointers.
+struct pxtnMOOEVENT {
+  int32_t clock;
+  int32_t value;
+  // Index of the next ON event of the same unit, or -1.
+  int32_t next_on;
+  uint8_t kind;
+  uint8_t unit_no;
+};
 
 // Static parameters that are computed when moo is initialized.
 struct mooParams {
@@ -56,33 +76,60 @@ struct mooParams {
 
   mooParams();
 
-  void processEvent(pxtnUnitTone *p_u, const EVERECORD *e, int32_t clock,
+  // [next_on] is the next ON event of the same unit, or NULL.
+  void processEvent(pxtnUnitTone *p_u, const pxtnMOOEVENT *e,
+                    const pxtnMOOEVENT *next_on, int32_t clock,
                     int32_t smp_num, const pxtnService *pxtn) const;
   void processNonOnEvent(pxtnUnitTone *p_u, EVENTKIND kind, int32_t value,
                          const pxtnService *pxtn) const;
 
   // TODO: maybe don't need to expose
   void resetVoiceOn(pxtnUnitTone *p_u) const;
+  // Before a note: readies the unit's woice if tones_ready left it out.
+  // False if it still isn't ready, and the note is dropped.
+  bool readyVoiceOn(pxtnUnitTone *p_u, const pxtnService *pxtn) const;
   void adjustClockRate(float rate) { clock_rate = rate; };
 };
 
+// The units right after a loop restart has caught up on the events before the
+// repeat point. Later restarts under the same conditions copy them back rather
+// than replaying all of those events within one sample.
+struct mooLoopSnapshot {
+  std::vector<pxtnUnitTone> units;
+  int32_t eve_index;  // -1 if there's no snapshot.
+  int32_t smp_count;
+  int32_t smp_end;
+  float clock_rate;
+  uint32_t version;  // The service's _moo_version when it was taken.
+
+  mooLoopSnapshot() : eve_index(-1) {}
+};
+
 // Moo values that change as the song plays.
 struct mooState {
   mooParams params;
   // Buffers that units write to for group operations
   std::vector<int32_t> group_smps;
+  // Group buffers for a whole block, [smp][ch][group].
+  std::vector<int32_t> block_smps;
+  // Mixed samples of a block before master volume, [smp][ch].
+  std::vector<int32_t> work_smps;
   int32_t time_pan_index;
   bool end_vomit;
 
   // Current sample position
   int32_t smp_count;
 
-  // Next event
-  const EVERECORD *p_eve;
+  // Index of the next event to play in pxtnService's playback events.
+  int32_t eve_index;
 
   // Number of times this moo has looped. For ptcollab bookkeeping.
   int num_loop;
 
+  // Unit-samples that block rendering skipped because the unit was silent.
+  // Only ever increases, so callers can sample it to measure the saving.
+  uint64_t skipped_unit_smps;
+
   int32_t fade_max;    // How long the fade lasts. (maybe could go in params)
   int32_t fade_count;  // How far into the fade we are.
   int32_t fade_fade;   // Fading in our out?
@@ -91,6 +138,10 @@ struct mooState {
   std::vector<pxtnUnitTone> units;
   std::vector<pxtnDelayTone> delays;
 
+  mooLoopSnapshot loop;
+  // Sample at which the last loop restart catches up on events, or -1.
+  int32_t loop_catch_up_smp;
+
   mooState();
 
   void release();
@@ -100,9 +151,15 @@ struct mooState {
   }
 
   void resetGroups(int32_t group_num);
-  bool resetUnits(size_t unit_num, std::shared_ptr<const pxtnWoice> woice);
+  bool resetUnits(size_t unit_num,
+                  const std::shared_ptr<const pxtnWoice> &woice);
   bool addUnit(std::shared_ptr<const pxtnWoice> woice);
 
+  // Restores units and eve_index from [loop] if it was taken under the same
+  // conditions. The caller has just reset the units for the restart.
+  bool restoreLoop(int32_t smp_end, uint32_t version);
+  void saveLoop(int32_t smp_end, uint32_t version);
+
   void tones_clear();
 };
 
@@ -146,7 +203,8 @@ class pxtnService {
 
   pxtnERR _ReadVersion(pxtnDescriptor *p_doc, _enum_FMTVER *p_fmt_ver,
                        uint16_t *p_exe_ver);
-  pxtnERR _ReadTuneItems(pxtnDescriptor *p_doc);
+  pxtnERR _ReadTuneItems(pxtnDescriptor *p_doc, bool b_meta);
+  pxtnERR _read(pxtnDescriptor *p_doc, bool b_meta);
   bool _x1x_Project_Read(pxtnDescriptor *p_doc);
 
   pxtnERR _io_Read_Delay(pxtnDescriptor *p_doc);
@@ -170,6 +228,10 @@ class pxtnService {
   // vomit..
   //////////////
   bool _moo_b_valid_data;
+  std::vector<pxtnMOOEVENT> _moo_events;
+  // Bumped whenever the events, woices or units change, so states can tell
+  // that what they derived from them is stale.
+  uint32_t _moo_version;
 
   pxtnERR _init(int32_t fix_evels_num, bool b_edit);
   bool _release();
@@ -179,7 +241,48 @@ class pxtnService {
   pxtnSampledCallback _sampled_proc;
   void *_sampled_user;
 
-  bool _moo_PXTONE_SAMPLE(void *p_data, mooState &moo_state) const;
+  pxtnTaskRunner _task_runner;
+  void *_task_runner_user;
+
+  pxtnRESAMPLE _resample;
+
+  bool _b_lazy_tones;
+  float _lazy_lead_sec;
+  // Woices tones_ready left out in lazy mode, shared with whoever readies
+  // them later.
+  std::shared_ptr<pxtnWOICEPENDING> _p_pending;
+  void _woice_first_clocks(std::vector<int32_t> &clocks) const;
+
+  // What the moo loop writes to its work buffer.
+  enum _enum_MOOMODE : int8_t {
+    _enum_MOOMODE_mix = 0,  // [smp][ch], the groups mixed after the effects
+    _enum_MOOMODE_groups,   // [group][ch][pxtnBUFSIZE_MOOBLOCK], no effects
+    _enum_MOOMODE_dry,      // nothing; see pxtnUnitTone::Tone_Advance
+  };
+
+  // A dry run with [unit_no] >= 0 only steps that unit on. Units don't
+  // affect each other, so their dry runs can go on separate threads.
+  bool _moo_PXTONE_SAMPLE(int32_t *p_work, mooState &moo_state,
+                          _enum_MOOMODE mode, int32_t unit_no) const;
+  int32_t _moo_PXTONE_BLOCK(int32_t *p_work, int32_t smp_num,
+                            mooState &moo_state,
+                            _enum_MOOMODE mode = _enum_MOOMODE_mix,
+                            int32_t unit_no = -1) const;
+  // Steps [moo_state] on by up to [smp_num] samples without rendering them.
+  // Returns how many before the song ended. The time-pan buffers are left
+  // silent and the delays where they were.
+  int32_t _moo_Skip_Dry(mooState &moo_state, int32_t smp_num,
+                        int32_t unit_no = -1) const;
+  int32_t _moo_SkipPreroll(const mooState &moo_state) const;
+  static void _moo_Parallel_Task(void *user, int32_t index);
+  static void _moo_Dry_Task(void *user, int32_t index);
+  static void _moo_Segment_Task(void *user, int32_t index);
+  static void _moo_Delay_Task(void *user, int32_t index);
+  static void _moo_Mix_Task(void *user, int32_t index);
+  int32_t _moo_BlockSize(const mooState &moo_state, int32_t smp_num,
+                         int32_t smp_end) const;
+  int32_t _moo_SmpEnd(const mooState &moo_state) const;
+  bool _moo_Loop(mooState &moo_state, int32_t smp_end) const;
 
  public:
   pxtnService();
@@ -195,12 +298,32 @@ class pxtnService {
 
   pxtnERR write(pxtnDescriptor *p_doc, bool bTune, uint16_t exe_ver);
   pxtnERR read(pxtnDescriptor *p_doc);
+  // Reads only the master, units and events, skipping woices, effects and
+  // texts. Enough for the song's length and tempo, but it can't be played.
+  pxtnERR read_meta(pxtnDescriptor *p_doc);
 
   bool AdjustMeasNum();
 
   int32_t get_last_error_id() const;
 
+  // Prepares the woices. This only depends on the song, so a service that has
+  // been read and readied can be shared by several moo states.
+  pxtnERR tones_ready();
+  // Flattens the event list for playback. tones_ready() does this too; call it
+  // again after editing events.
+  pxtnERR moo_events_ready();
+  // Prepares the per-playback buffers (delays) of [moo_state].
+  pxtnERR moo_tones_ready(mooState &moo_state) const;
   pxtnERR tones_ready(mooState &moo_state);
+  // Readies the woices the last tones_ready left out, in order of their first
+  // note; woices no event plays are skipped. Safe to run on another thread
+  // while the song plays. Returns the first error.
+  pxtnERR tones_ready_pending() const;
+  // Writes the ready woices, so that tones_read can stand in for tones_ready
+  // on a service read from the same song, at the same rate and resampling.
+  // Woices the last tones_ready left out are readied first.
+  pxtnERR tones_write(pxtnDescriptor *p_doc) const;
+  pxtnERR tones_read(pxtnDescriptor *p_doc);
 
   int32_t Group_Num() const;
 
@@ -233,6 +356,9 @@ class pxtnService {
 
   pxtnERR Woice_read(int32_t idx, pxtnDescriptor *desc, pxtnWOICETYPE type);
   pxtnERR Woice_ReadyTone(std::shared_ptr<pxtnWoice> woice) const;
+  // Readies [p_woice] now if tones_ready left it out, or waits for the
+  // thread that is readying it. Units call this before playing a note.
+  void Woice_ReadyPending(const pxtnWoice *p_woice) const;
   bool Woice_Remove(int32_t idx);
   bool Woice_Replace(int32_t old_place, int32_t new_place);
 
@@ -253,6 +379,20 @@ class pxtnService {
   bool get_destination_quality(int32_t *p_ch_num, int32_t *p_sps) const;
   bool get_byte_per_smp(int32_t *p_byte_per_smp) const;
   bool set_sampled_callback(pxtnSampledCallback proc, void *user);
+  // Runner used by tones_ready to ready the woices, and the units of noise
+  // woices, in parallel, and by Moo_f32_Parallel. NULL (the default) uses
+  // pxtnTask_Run_Threads.
+  bool set_task_runner(pxtnTaskRunner runner, void *user);
+  // How sampled and Ogg voices not at 44100Hz are converted when readied.
+  // pxtnRESAMPLE_nearest (the default) sounds like pxtone itself; takes
+  // effect on the next tones_ready.
+  bool set_resample(pxtnRESAMPLE resample);
+  pxtnRESAMPLE get_resample() const;
+  // Lazy readying, off by default: tones_ready skips woices no event plays
+  // and only readies those first played within [lead_sec] seconds of the
+  // start. The rest are left to tones_ready_pending, or to the first unit
+  // that plays them, which then waits for them.
+  bool set_lazy_tones(bool b, float lead_sec);
 
   //////////////
   // Moo..
@@ -260,6 +400,27 @@ class pxtnService {
 
   bool Moo(mooState &moo_state, void *p_buf, int32_t size,
            int32_t *filled_size = nullptr) const;
+  // Same as Moo, but writes [smp_num] interleaved float samples in [-1, 1)
+  // without going through 16 bits. [filled_num] is the number of samples
+  // rendered before the end of the song; the rest is filled with silence.
+  bool Moo_f32(mooState &moo_state, float *p_buf, int32_t smp_num,
+               int32_t *filled_num = nullptr,
+               pxtnMOOLIMIT limit = pxtnMOOLIMIT_clamp) const;
+  // Moves [moo_state] on by [smp_num] samples, as Moo_f32 would, without
+  // rendering most of them. Voices step on exactly, but only the last
+  // samples are rendered: enough for the time-pan buffers, which come out
+  // exact, and for the delay lines to settle to within about 1/256 of what
+  // they would hold. [skipped_num] is short if the song ended.
+  bool Moo_Skip(mooState &moo_state, int32_t smp_num,
+                int32_t *skipped_num = nullptr) const;
+  // Same as Moo_f32, for offline rendering on several cores. A dry run through
+  // the span finds the state each segment of it starts from, the segments
+  // are rendered in parallel with the task runner, and the delays are run
+  // over them in order. Spans that take many segments go fastest. Short spans
+  // and fades go through Moo_f32.
+  bool Moo_f32_Parallel(mooState &moo_state, float *p_buf, int32_t smp_num,
+                        int32_t *filled_num = nullptr,
+                        pxtnMOOLIMIT limit = pxtnMOOLIMIT_clamp) const;
 
   int32_t moo_tone_sample_multi(std::map<int, pxtnUnitTone *> p_us,
                                 const mooParams &params, void *data,
@@ -290,6 +451,9 @@ class pxtnService {
   bool moo_set_master_volume(float v);
 
   int32_t moo_get_total_sample() const;
+  // Sample at which [moo_state] reaches the end of the song, and loops back to
+  // the repeat measure if it loops.
+  int32_t moo_get_end_sample(const mooState &moo_state) const;
 
   int32_t moo_get_now_clock(const mooState &moo_state) const;
   int32_t moo_get_end_clock() const;
@@ -1,6 +1,9 @@
 
+#include <math.h>
+
 #include "./pxtn.h"
 #include "./pxtnMem.h"
+#include "./pxtnMix.h"
 #include "./pxtnService.h"
 
 mooParams::mooParams() {
@@ -11,20 +14,34 @@ mooParams::mooParams() {
 }
 
 mooState::mooState() {
-  p_eve = NULL;
+  eve_index = 0;
   num_loop = 0;
+  skipped_unit_smps = 0;
   smp_count = 0;
   fade_fade = 0;
   end_vomit = true;
+  loop_catch_up_smp = -1;
 }
 
 void mooState::resetGroups(int32_t group_num) {
   group_smps.clear();
   group_smps.resize(group_num, 0);
+  block_smps.clear();
+  block_smps.resize(pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL * group_num, 0);
+  work_smps.clear();
+  work_smps.resize(pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL, 0);
 }
 
 bool mooState::resetUnits(size_t unit_num,
-                          std::shared_ptr<const pxtnWoice> woice) {
+                          const std::shared_ptr<const pxtnWoice> &woice) {
+  // Loop restarts land here on the audio thread, so reuse the tones if we can.
+  if (woice && units.size() == unit_num) {
+    for (size_t i = 0; i < unit_num; ++i) {
+      units[i].Tone_Init(woice);
+      params.resetVoiceOn(&units[i]);
+    }
+    return true;
+  }
   units.clear();
   units.reserve(unit_num);
   for (size_t i = 0; i < unit_num; ++i)
@@ -39,6 +56,26 @@ bool mooState::addUnit(std::shared_ptr<const pxtnWoice> woice) {
   return true;
 }
 
+bool mooState::restoreLoop(int32_t smp_end, uint32_t version) {
+  if (loop.eve_index < 0 || loop.smp_count != smp_count ||
+      loop.smp_end != smp_end || loop.clock_rate != params.clock_rate ||
+      loop.version != version || loop.units.size() != units.size())
+    return false;
+  for (size_t i = 0; i < units.size(); ++i)
+    units[i].Tone_Restore(loop.units[i]);
+  eve_index = loop.eve_index;
+  return true;
+}
+
+void mooState::saveLoop(int32_t smp_end, uint32_t version) {
+  loop.units = units;
+  loop.eve_index = eve_index;
+  loop.smp_count = smp_count;
+  loop.smp_end = smp_end;
+  loop.clock_rate = params.clock_rate;
+  loop.version = version;
+}
+
 ////////////////////////////////////////////////
 // Units   ////////////////////////////////////
 ////////////////////////////////////////////////
@@ -47,6 +84,14 @@ void mooParams::resetVoiceOn(pxtnUnitTone* p_u) const {
   p_u->Tone_Reset(bt_tempo, clock_rate);
 }
 
+bool mooParams::readyVoiceOn(pxtnUnitTone* p_u,
+                             const pxtnService* pxtn) const {
+  if (!p_u->is_woice_pending()) return true;
+  pxtn->Woice_ReadyPending(p_u->get_woice().get());
+  resetVoiceOn(p_u);
+  return !p_u->is_woice_pending();
+}
+
 bool pxtnService::_moo_InitUnitTone(mooState& moo_state) const {
   return moo_state.resetUnits(_unit_num, Woice_Get(EVENTDEFAULT_VOICENO));
 }
@@ -100,6 +145,7 @@ void mooParams::processNonOnEvent(pxtnUnitTone* p_u, EVENTKIND kind,
     case EVENTKIND_ON: {
       // A bit hacky but interpret EVENTKIND_ON value as how much time is left
       std::shared_ptr<const pxtnWoice> p_wc;
+      if (!readyVoiceOn(p_u, pxtn)) break;
       if (!(p_wc = p_u->get_woice())) break;
       for (int32_t v = 0; v < p_wc->get_voice_num(); v++) {
         pxtnVOICETONE* p_tone = p_u->get_tone(v);
@@ -113,9 +159,9 @@ void mooParams::processNonOnEvent(pxtnUnitTone* p_u, EVENTKIND kind,
 
 // u is used to look ahead to cut short notes whose release go into the next.
 // This note duration cutting is for the smoothing near the end of a note.
-void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
-                             int32_t clock, int32_t smp_end,
-                             const pxtnService* pxtn) const {
+void mooParams::processEvent(pxtnUnitTone* p_u, const pxtnMOOEVENT* e,
+                             const pxtnMOOEVENT* next_on, int32_t clock,
+                             int32_t smp_end, const pxtnService* pxtn) const {
   pxtnVOICETONE* p_tone;
   std::shared_ptr<const pxtnWoice> p_wc;
   const pxtnVOICEINSTANCE* p_vi;
@@ -130,6 +176,7 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
 
       p_u->Tone_KeyOn();
 
+      if (!readyVoiceOn(p_u, pxtn)) break;
       if (!(p_wc = p_u->get_woice())) break;
       for (int32_t v = 0; v < p_wc->get_voice_num(); v++) {
         p_tone = p_u->get_tone(v);
@@ -144,14 +191,8 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
               p_vi->env_release;
           int32_t max_life_count2;
           int32_t c = e->clock + e->value + p_tone->env_release_clock;
-          EVERECORD* next = NULL;
-          for (EVERECORD* p = e->next; p; p = p->next) {
-            if (p->clock > c) break;
-            if (p->unit_no == e->unit_no && p->kind == EVENTKIND_ON) {
-              next = p;
-              break;
-            }
-          }
+          const pxtnMOOEVENT* next = NULL;
+          if (next_on && next_on->clock <= c) next = next_on;
           /* end the note at the end of the song if there's no next note */
           if (!next) {
             if (smp_end == -1)
@@ -194,52 +235,85 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
 
 // TODO: Could probably put this in moo_state. Maybe make moo_state.params a
 // member of it.
-bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
+// Writes the mixed groups of each channel to [p_work], before master volume
+// and clamping. In groups mode, group g of channel ch goes to
+// p_work[(g * ch_num + ch) * pxtnBUFSIZE_MOOBLOCK] instead.
+bool pxtnService::_moo_PXTONE_SAMPLE(int32_t* p_work, mooState& moo_state,
+                                     _enum_MOOMODE mode,
+                                     int32_t unit_no) const {
+  size_t u_begin = 0, u_end = moo_state.units.size();
+  if (unit_no >= 0) {
+    u_begin = unit_no;
+    u_end = unit_no + 1;
+  }
+
   // envelope..
-  for (size_t u = 0; u < moo_state.units.size(); u++)
+  for (size_t u = u_begin; u < u_end; u++)
     moo_state.units[u].Tone_Envelope();
 
   int32_t clock = (int32_t)(moo_state.smp_count / moo_state.params.clock_rate);
 
   /* Adding constant update to moo_smp_end since we might be editing while
    * playing */
-  int32_t smp_end = ((double)master->get_play_meas() * master->get_beat_num() *
-                     master->get_beat_clock() * moo_state.params.clock_rate);
+  int32_t smp_end = _moo_SmpEnd(moo_state);
 
   /* Notify all the units of events that occurred since the last time
      increment and adjust sampling parameters accordingly */
   // events..
 
-  // Keep the last played event in moo_state, so that if a new event pops up
-  // during playback at the end, it's not missed.
+  // Keep the position in the event array in moo_state. Events edited during
+  // playback are only picked up once moo_events_ready() has been called.
   // Handling arbitrary changes while playing is a bit more difficult. You'd
   // have to split by event type at least, since something near the beginning
   // could have lasting effects to now.
-  const EVERECORD* next =
-      (moo_state.p_eve ? moo_state.p_eve->next : evels->get_Records());
-  while (next && next->clock <= clock) {
-    int32_t u = next->unit_no;
+
+  // Right after a loop restart every event before the repeat point is due at
+  // once. Replay them only the first time and restore the result after that.
+  bool b_catch_up = moo_state.loop_catch_up_smp == moo_state.smp_count;
+  moo_state.loop_catch_up_smp = -1;
+  if (b_catch_up && moo_state.restoreLoop(smp_end, _moo_version))
+    b_catch_up = false;
+
+  const pxtnMOOEVENT* events = _moo_events.data();
+  int32_t event_num = (int32_t)_moo_events.size();
+  while (moo_state.eve_index < event_num &&
+         events[moo_state.eve_index].clock <= clock) {
+    const pxtnMOOEVENT* e = &events[moo_state.eve_index];
+    int32_t u = e->unit_no;
     // TODO: Be robust to if there's a mention of a new unit. Generate the new
     // unit on the fly? (update: currently done by adding in the controller)
-    moo_state.params.processEvent(&moo_state.units[u], next, clock, smp_end,
-                                  this);
-    moo_state.p_eve = next;
-    next = moo_state.p_eve->next;
+    if (unit_no < 0 || u == unit_no)
+      moo_state.params.processEvent(
+          &moo_state.units[u], e,
+          e->next_on >= 0 ? &events[e->next_on] : NULL, clock, smp_end, this);
+    moo_state.eve_index++;
   }
+  if (b_catch_up) moo_state.saveLoop(smp_end, _moo_version);
 
   // sampling..
-  for (size_t u = 0; u < moo_state.units.size(); u++) {
+  for (size_t u = u_begin; u < u_end; u++) {
     bool muted = moo_state.params.b_mute_by_unit && !_units[u]->get_played();
-    moo_state.units[u].Tone_Sample(muted, _dst_ch_num, moo_state.time_pan_index,
-                                   moo_state.params.smp_smooth);
+    if (mode == _enum_MOOMODE_dry)
+      moo_state.units[u].Tone_Sample_Dry(muted, _dst_ch_num,
+                                         moo_state.time_pan_index);
+    else
+      moo_state.units[u].Tone_Sample(muted, _dst_ch_num,
+                                     moo_state.time_pan_index,
+                                     moo_state.params.smp_smooth);
   }
 
-  for (int32_t ch = 0; ch < _dst_ch_num; ch++) {
+  for (int32_t ch = 0; ch < _dst_ch_num && mode != _enum_MOOMODE_dry; ch++) {
     for (int32_t g = 0; g < _group_num; g++) moo_state.group_smps[g] = 0;
     /* Sample the units into a group buffer */
     for (size_t u = 0; u < moo_state.units.size(); u++)
       moo_state.units[u].Tone_Supple(moo_state.group_smps.data(), ch,
                                      moo_state.time_pan_index);
+    if (mode == _enum_MOOMODE_groups) {
+      for (int32_t g = 0; g < _group_num; g++)
+        p_work[(g * _dst_ch_num + ch) * pxtnBUFSIZE_MOOBLOCK] =
+            moo_state.group_smps[g];
+      continue;
+    }
     /* Add overdrive, delay to group buffer */
     for (size_t o = 0; o < _ovdrvs.size(); o++)
       _ovdrvs[o].Tone_Supple(moo_state.group_smps.data());
@@ -260,13 +334,7 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
     if (moo_state.fade_fade)
       work = work * (moo_state.fade_count >> 8) / moo_state.fade_max;
 
-    // master volume
-    work = (int32_t)(work * moo_state.params.master_vol);
-
-    // to buffer..
-    if (work > moo_state.params.top) work = moo_state.params.top;
-    if (work < -moo_state.params.top) work = -moo_state.params.top;
-    *((int16_t*)p_data + ch) = (int16_t)(work);
+    p_work[ch] = work;
   }
 
   // --------------
@@ -276,15 +344,17 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
   moo_state.time_pan_index =
       (moo_state.time_pan_index + 1) & (pxtnBUFSIZE_TIMEPAN - 1);
 
-  for (size_t u = 0; u < moo_state.units.size(); u++) {
+  for (size_t u = u_begin; u < u_end; u++) {
     int32_t key_now = moo_state.units[u].Tone_Increment_Key();
     moo_state.units[u].Tone_Increment_Sample(
         pxtnPulse_Frequency::Get2(key_now) * moo_state.params.smp_stride);
   }
 
   // delay
-  for (size_t d = 0; d < moo_state.delays.size(); d++)
-    moo_state.delays[d].Tone_Increment();
+  if (mode == _enum_MOOMODE_mix) {
+    for (size_t d = 0; d < moo_state.delays.size(); d++)
+      moo_state.delays[d].Tone_Increment();
+  }
 
   // fade out
   if (moo_state.fade_fade < 0) {
@@ -301,6 +371,17 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
       moo_state.fade_fade = 0;
   }
 
+  return _moo_Loop(moo_state, smp_end);
+}
+
+int32_t pxtnService::_moo_SmpEnd(const mooState& moo_state) const {
+  return ((double)master->get_play_meas() * master->get_beat_num() *
+          master->get_beat_clock() * moo_state.params.clock_rate);
+}
+
+// Jumps back to the repeat point once [smp_end] is reached. Returns false if
+// the song is over.
+bool pxtnService::_moo_Loop(mooState& moo_state, int32_t smp_end) const {
   while (moo_state.smp_count >= smp_end) {
     if (!moo_state.params.b_loop) return false;
     ++moo_state.num_loop;
@@ -308,12 +389,150 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
     moo_state.smp_count +=
         master->get_this_clock(master->get_repeat_meas(), 0, 0) *
         moo_state.params.clock_rate;
-    moo_state.p_eve = nullptr;
+    moo_state.eve_index = 0;
     _moo_InitUnitTone(moo_state);
+    moo_state.loop_catch_up_smp = moo_state.smp_count;
   }
   return true;
 }
 
+// How many of the next [smp_num] samples can be rendered as one block, i.e.
+// without an event, a fade step or the end of the song in between. Returns 0 if
+// the next sample has to go through _moo_PXTONE_SAMPLE.
+int32_t pxtnService::_moo_BlockSize(const mooState& moo_state, int32_t smp_num,
+                                    int32_t smp_end) const {
+  if (moo_state.fade_fade) return 0;
+
+  // Stop one short of the end so the loop is handled by the per-sample path.
+  int32_t smp_count = moo_state.smp_count;
+  if (smp_num > smp_end - smp_count - 1) smp_num = smp_end - smp_count - 1;
+  if (smp_num <= 0) return 0;
+
+  if (moo_state.eve_index >= (int32_t)_moo_events.size()) return smp_num;
+  const pxtnMOOEVENT* next = &_moo_events[moo_state.eve_index];
+
+  // The clock of a sample is computed exactly as in _moo_PXTONE_SAMPLE. It
+  // never decreases, so the first sample that reaches the next event can be
+  // bisected for.
+  float clock_rate = moo_state.params.clock_rate;
+  if ((int32_t)(smp_count / clock_rate) >= next->clock) return 0;
+  if ((int32_t)((smp_count + smp_num - 1) / clock_rate) < next->clock)
+    return smp_num;
+
+  int32_t lo = 0, hi = smp_num - 1;  // lo is before the event, hi is not.
+  while (hi - lo > 1) {
+    int32_t mid = (lo + hi) / 2;
+    if ((int32_t)((smp_count + mid) / clock_rate) < next->clock)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return hi;
+}
+
+// Renders up to [smp_num] (at most pxtnBUFSIZE_MOOBLOCK) samples to [p_work]
+// in the same format as _moo_PXTONE_SAMPLE, skipping the per-sample event and
+// loop checks between events. Returns how many samples were written before the
+// song ended. A dry run takes any [smp_num] and goes from event to event.
+int32_t pxtnService::_moo_PXTONE_BLOCK(int32_t* p_work, int32_t smp_num,
+                                       mooState& moo_state,
+                                       _enum_MOOMODE mode,
+                                       int32_t unit_no) const {
+  int32_t ch_num = _dst_ch_num;
+  int32_t smp_w = 0;
+  size_t u_begin = 0, u_end = moo_state.units.size();
+  if (unit_no >= 0) {
+    u_begin = unit_no;
+    u_end = unit_no + 1;
+  }
+
+  while (smp_w < smp_num) {
+    int32_t smp_end = _moo_SmpEnd(moo_state);
+    int32_t req = smp_num - smp_w;
+    if (mode != _enum_MOOMODE_dry && req > pxtnBUFSIZE_MOOBLOCK)
+      req = pxtnBUFSIZE_MOOBLOCK;
+    int32_t block_num = _moo_BlockSize(moo_state, req, smp_end);
+
+    // [group][ch][smp], so the stages below work on whole spans.
+    int32_t* p_block = NULL;
+    if (mode == _enum_MOOMODE_mix)
+      p_block = moo_state.block_smps.data();
+    else if (mode == _enum_MOOMODE_groups)
+      p_block = &p_work[smp_w];
+
+    if (!block_num) {
+      int32_t* p_smp = p_block;
+      if (mode == _enum_MOOMODE_mix) p_smp = &p_work[smp_w * ch_num];
+      if (!_moo_PXTONE_SAMPLE(p_smp, moo_state, mode, unit_no)) break;
+      smp_w++;
+      continue;
+    }
+
+    if (p_block) {
+      for (int32_t c = 0; c < _group_num * ch_num; c++)
+        memset(&p_block[c * pxtnBUFSIZE_MOOBLOCK], 0,
+               sizeof(int32_t) * block_num);
+    }
+
+    for (size_t u = u_begin; u < u_end; u++) {
+      // Nothing sounds until the unit's next ON event, which can't fall
+      // inside this block.
+      if (moo_state.units[u].Tone_IsSilent()) {
+        moo_state.units[u].Tone_Skip(block_num);
+        moo_state.skipped_unit_smps += block_num;
+        continue;
+      }
+      bool muted = moo_state.params.b_mute_by_unit && !_units[u]->get_played();
+      if (!p_block) {
+        moo_state.units[u].Tone_Advance(muted, moo_state.params.smp_stride,
+                                        block_num);
+        continue;
+      }
+      moo_state.units[u].Tone_Render(
+          muted, ch_num, moo_state.time_pan_index, moo_state.params.smp_smooth,
+          moo_state.params.smp_stride, p_block, block_num);
+    }
+
+    moo_state.smp_count += block_num;
+    moo_state.time_pan_index =
+        (moo_state.time_pan_index + block_num) & (pxtnBUFSIZE_TIMEPAN - 1);
+    if (mode != _enum_MOOMODE_mix) {
+      smp_w += block_num;
+      continue;
+    }
+
+    // Per sample, every overdrive runs before any delay and each only touches
+    // its own group, so they can go one after another over the block.
+    for (size_t o = 0; o < _ovdrvs.size(); o++) {
+      for (int32_t ch = 0; ch < ch_num; ch++)
+        _ovdrvs[o].Tone_Supple_Block(
+            &p_block[(_ovdrvs[o].get_group() * ch_num + ch) *
+                     pxtnBUFSIZE_MOOBLOCK],
+            block_num);
+    }
+    for (size_t d = 0; d < _delays.size(); d++) {
+      for (int32_t ch = 0; ch < ch_num; ch++)
+        moo_state.delays[d].Tone_Supple_Block(
+            _delays[d], ch,
+            &p_block[(_delays[d].get_group() * ch_num + ch) *
+                     pxtnBUFSIZE_MOOBLOCK],
+            block_num);
+      moo_state.delays[d].Tone_Increment_Block(block_num);
+    }
+
+    for (int32_t ch = 0; ch < ch_num; ch++) {
+      int32_t* p_sum = &p_block[ch * pxtnBUFSIZE_MOOBLOCK];
+      for (int32_t g = 1; g < _group_num; g++)
+        pxtnMix_Add(p_sum, &p_block[(g * ch_num + ch) * pxtnBUFSIZE_MOOBLOCK],
+                    block_num);
+      for (int32_t i = 0; i < block_num; i++)
+        p_work[(smp_w + i) * ch_num + ch] = p_sum[i];
+    }
+    smp_w += block_num;
+  }
+  return smp_w;
+}
+
 ///////////////////////
 // get / set
 ///////////////////////
@@ -450,10 +669,14 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
 
   moo_state.tones_clear();
 
-  moo_state.p_eve = nullptr;
+  moo_state.eve_index = 0;
   moo_state.num_loop = 0;
+  moo_state.loop = mooLoopSnapshot();
+  moo_state.loop_catch_up_smp = -1;
 
   _moo_InitUnitTone(moo_state);
+  // So the first loop's snapshot doesn't allocate on the audio thread.
+  moo_state.loop.units.reserve(moo_state.units.size());
 
   b_ret = true;
   moo_state.end_vomit = false;
@@ -473,6 +696,12 @@ int32_t pxtnService::moo_get_total_sample() const {
                                        master->get_beat_tempo());
 }
 
+int32_t pxtnService::moo_get_end_sample(const mooState& moo_state) const {
+  if (!_b_init) return 0;
+  if (!_moo_b_valid_data) return 0;
+  return _moo_SmpEnd(moo_state);
+}
+
 ////////////////////
 // Moo ...
 ////////////////////
@@ -499,17 +728,21 @@ bool pxtnService::Moo(
   {
     /* Buffer is renamed here */
     int16_t* p16 = (int16_t*)p_buf;
-    int16_t sample[2]; /* for left and right? */
-
-    /* Iterate thru samples [smp_num] times, fill buffer with this sample */
-    for (smp_w = 0; smp_w < smp_num; smp_w++) {
-      if (!_moo_PXTONE_SAMPLE(sample, moo_state)) {
-        moo_state.end_vomit = true;
-        break;
-      }
-      for (int ch = 0; ch < _dst_ch_num; ch++, p16++) {
-        *p16 = sample[ch];
-      }
+    int32_t top = moo_state.params.top;
+    float master_vol = moo_state.params.master_vol;
+
+    while (smp_w < smp_num && !moo_state.end_vomit) {
+      int32_t req = smp_num - smp_w;
+      if (req > pxtnBUFSIZE_MOOBLOCK) req = pxtnBUFSIZE_MOOBLOCK;
+      int32_t done = _moo_PXTONE_BLOCK(moo_state.work_smps.data(), req,
+                                       moo_state);
+      if (done < req) moo_state.end_vomit = true;
+
+      // master volume, to buffer..
+      pxtnMix_ToS16(moo_state.work_smps.data(), p16, done * _dst_ch_num,
+                    master_vol, top);
+      p16 += done * _dst_ch_num;
+      smp_w += done;
     }
     for (; smp_w < smp_num; smp_w++) {
       for (int ch = 0; ch < _dst_ch_num; ch++, p16++) *p16 = 0;
@@ -530,6 +763,477 @@ term:
   return b_ret;
 }
 
+// Soft knee: linear up to the threshold, then eases towards full scale.
+static inline float _moo_SoftLimit(float v) {
+  const float threshold = 0.75f;
+  if (v > threshold)
+    return threshold + (1.0f - threshold) * tanhf((v - threshold) /
+                                                  (1.0f - threshold));
+  if (v < -threshold)
+    return -threshold - (1.0f - threshold) * tanhf((-v - threshold) /
+                                                   (1.0f - threshold));
+  return v;
+}
+
+// Master volume and [limit], from [num] mixed work samples to floats.
+static void _moo_ToF32(const int32_t* p_work, float* p_f32, int32_t num,
+                       const mooParams& params, pxtnMOOLIMIT limit) {
+  float vol = params.master_vol / 32768.0f;
+  float top = params.top / 32768.0f;
+  switch (limit) {
+    case pxtnMOOLIMIT_none:
+    case pxtnMOOLIMIT_clamp:
+      pxtnMix_ToF32(p_work, p_f32, num, vol, limit == pxtnMOOLIMIT_clamp, top);
+      break;
+    case pxtnMOOLIMIT_soft:
+      for (int32_t i = 0; i < num; i++)
+        p_f32[i] = _moo_SoftLimit(p_work[i] * vol);
+      break;
+  }
+}
+
+bool pxtnService::Moo_f32(mooState& moo_state, float* p_buf, int32_t smp_num,
+                          int32_t* filled_num, pxtnMOOLIMIT limit) const {
+  if (filled_num) *filled_num = 0;
+
+  if (!_moo_b_valid_data) return false;
+  if (moo_state.end_vomit) return false;
+
+  int32_t smp_w = 0;
+  float* p_f32 = p_buf;
+
+  while (smp_w < smp_num && !moo_state.end_vomit) {
+    int32_t req = smp_num - smp_w;
+    if (req > pxtnBUFSIZE_MOOBLOCK) req = pxtnBUFSIZE_MOOBLOCK;
+    int32_t done =
+        _moo_PXTONE_BLOCK(moo_state.work_smps.data(), req, moo_state);
+    if (done < req) moo_state.end_vomit = true;
+
+    int32_t num = done * _dst_ch_num;
+    _moo_ToF32(moo_state.work_smps.data(), p_f32, num, moo_state.params, limit);
+    p_f32 += num;
+    smp_w += done;
+  }
+  if (filled_num) *filled_num = smp_w;
+  for (; smp_w < smp_num; smp_w++) {
+    for (int ch = 0; ch < _dst_ch_num; ch++) *p_f32++ = 0;
+  }
+
+  if (_sampled_proc) {
+    if (!_sampled_proc(_sampled_user, this)) {
+      moo_state.end_vomit = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+////////////////////
+// Skip ...
+////////////////////
+
+int32_t pxtnService::_moo_Skip_Dry(mooState& moo_state, int32_t smp_num,
+                                   int32_t unit_no) const {
+  return _moo_PXTONE_BLOCK(NULL, smp_num, moo_state, _enum_MOOMODE_dry,
+                           unit_no);
+}
+
+// How many samples Moo_Skip renders at the end, for the time-pan buffers to
+// fill up and the delay lines to settle.
+int32_t pxtnService::_moo_SkipPreroll(const mooState& moo_state) const {
+  int32_t preroll = pxtnBUFSIZE_TIMEPAN;
+  for (size_t d = 0; d < moo_state.delays.size(); d++) {
+    int32_t settle = moo_state.delays[d].Tone_Settle_Smp();
+    if (settle > preroll) preroll = settle;
+  }
+  return preroll;
+}
+
+bool pxtnService::Moo_Skip(mooState& moo_state, int32_t smp_num,
+                           int32_t* skipped_num) const {
+  if (skipped_num) *skipped_num = 0;
+
+  if (!_moo_b_valid_data) return false;
+  if (moo_state.end_vomit) return false;
+
+  int32_t smp_w = 0;
+  int32_t dry_num = smp_num - _moo_SkipPreroll(moo_state);
+  if (dry_num > 0) {
+    smp_w = _moo_Skip_Dry(moo_state, dry_num);
+    // What the delay lines held is replaced by what the pre-roll feeds them.
+    for (size_t d = 0; d < moo_state.delays.size(); d++) {
+      moo_state.delays[d].Tone_Clear();
+      moo_state.delays[d].Tone_Increment_Block(smp_w);
+    }
+    if (smp_w < dry_num) moo_state.end_vomit = true;
+  }
+
+  while (smp_w < smp_num && !moo_state.end_vomit) {
+    int32_t req = smp_num - smp_w;
+    if (req > pxtnBUFSIZE_MOOBLOCK) req = pxtnBUFSIZE_MOOBLOCK;
+    int32_t done =
+        _moo_PXTONE_BLOCK(moo_state.work_smps.data(), req, moo_state);
+    if (done < req) moo_state.end_vomit = true;
+    smp_w += done;
+  }
+  if (skipped_num) *skipped_num = smp_w;
+  return true;
+}
+
+////////////////////
+// Moo in parallel..
+////////////////////
+
+// Moo_f32_Parallel cuts a span into segments of _moo_SEGMENT_SMP samples, and
+// the segments into windows of _moo_WINDOW_SEG. A window takes four rounds of
+// tasks: a dry run finds the state each of its segments starts from, the
+// segments are rendered, the delays run over the window, and the segments are
+// mixed down. Each round works on four windows at once, so the parts that
+// can't be split much overlap with the parts that can.
+#define _moo_SEGMENT_SMP 8192
+#define _moo_WINDOW_SEG 32
+#define _moo_WINDOW_SMP (_moo_SEGMENT_SMP * _moo_WINDOW_SEG)
+
+struct _MOOSEGMENT {
+  // Where the segment starts from. For all but the first segment this is a
+  // dry run's state [preroll_num] samples ahead of the segment, whose
+  // time-pan buffers the segment refills by rendering them.
+  mooState state;
+  int32_t preroll_num;
+  int32_t smp_num;
+  int32_t done_num;  // rendered before the song ended
+};
+
+struct _MOOWINDOW {
+  int32_t seg_begin;
+  int32_t seg_num;
+  int32_t smp_num;  // rendered, once the segments are done
+  _MOOSEGMENT segs[_moo_WINDOW_SEG];
+  // [slot][ch][_moo_WINDOW_SMP]. Slot 0 sums up the groups without a delay,
+  // after their overdrives. The groups with one have a slot each.
+  std::vector<int32_t> slots;
+};
+
+typedef struct {
+  const pxtnService* pxtn;
+  mooState* p_moo;
+  float* p_buf;
+  pxtnMOOLIMIT limit;
+  int32_t smp_num;
+  int32_t slot_of_group[pxtnMAX_TUNEGROUPNUM];
+  int32_t slot_num;
+
+  // The dry runs, one per unit or one for all of them, and how far into the
+  // span they are.
+  int32_t dry_num;
+  mooState* drys;
+  int32_t* dry_smps;
+  // Per unit but the first, its tone and loop snapshot tone ahead of each
+  // segment of the window being dry-run. The first leaves whole states.
+  std::vector<pxtnUnitTone>* tones;
+  int32_t end_seg;  // the first segment the song doesn't reach
+
+  _MOOWINDOW* p_dry;
+  _MOOWINDOW* p_render;
+  _MOOWINDOW* p_delay;
+  _MOOWINDOW* p_mix;
+} _MOOPARALLEL;
+
+void pxtnService::_moo_Dry_Task(void* user, int32_t index) {
+  _MOOPARALLEL* par = (_MOOPARALLEL*)user;
+  const pxtnService* pxtn = par->pxtn;
+  _MOOWINDOW* win = par->p_dry;
+  mooState& dry = par->drys[index];
+  int32_t& dry_smp = par->dry_smps[index];
+  int32_t unit_no = par->dry_num > 1 ? index : -1;
+
+  for (int32_t k = 0; k < win->seg_num; k++) {
+    int32_t g = win->seg_begin + k;
+    if (!g) continue;
+    int32_t start = g * _moo_SEGMENT_SMP - pxtnBUFSIZE_TIMEPAN;
+    if (dry_smp < start)
+      dry_smp += pxtn->_moo_Skip_Dry(dry, start - dry_smp, unit_no);
+    // The song ends within the previous segment.
+    if (dry_smp < start) {
+      if (!index) par->end_seg = g;
+      return;
+    }
+    if (!index) {
+      win->segs[k].state = dry;
+      continue;
+    }
+    std::vector<pxtnUnitTone>& tones = par->tones[index];
+    tones[k * 2] = dry.units[index];
+    if (dry.loop.units.size() > (size_t)index)
+      tones[k * 2 + 1] = dry.loop.units[index];
+  }
+}
+
+void pxtnService::_moo_Segment_Task(void* user, int32_t index) {
+  const _MOOPARALLEL* par = (const _MOOPARALLEL*)user;
+  const pxtnService* pxtn = par->pxtn;
+  _MOOWINDOW* win = par->p_render;
+  _MOOSEGMENT* seg = &win->segs[index];
+  mooState& moo_state = seg->state;
+  int32_t ch_num = pxtn->_dst_ch_num;
+  int32_t* p_groups = moo_state.block_smps.data();
+  int32_t* p_slots = &win->slots[index * _moo_SEGMENT_SMP];
+  for (int32_t c = 0; c < par->slot_num * ch_num; c++)
+    memset(&p_slots[c * _moo_WINDOW_SMP], 0,
+           sizeof(int32_t) * _moo_SEGMENT_SMP);
+
+  seg->done_num = 0;
+  for (int32_t pre = seg->preroll_num; pre > 0;) {
+    int32_t req = pre < pxtnBUFSIZE_MOOBLOCK ? pre : pxtnBUFSIZE_MOOBLOCK;
+    int32_t done = pxtn->_moo_PXTONE_BLOCK(p_groups, req, moo_state,
+                                           _enum_MOOMODE_groups);
+    if (done < req) return;
+    pre -= done;
+  }
+
+  while (seg->done_num < seg->smp_num) {
+    int32_t req = seg->smp_num - seg->done_num;
+    if (req > pxtnBUFSIZE_MOOBLOCK) req = pxtnBUFSIZE_MOOBLOCK;
+    int32_t done = pxtn->_moo_PXTONE_BLOCK(p_groups, req, moo_state,
+                                           _enum_MOOMODE_groups);
+
+    // Overdrives keep no state, so they can run here.
+    for (size_t o = 0; o < pxtn->_ovdrvs.size(); o++) {
+      for (int32_t ch = 0; ch < ch_num; ch++)
+        pxtn->_ovdrvs[o].Tone_Supple_Block(
+            &p_groups[(pxtn->_ovdrvs[o].get_group() * ch_num + ch) *
+                      pxtnBUFSIZE_MOOBLOCK],
+            done);
+    }
+    for (int32_t g = 0; g < pxtn->_group_num; g++) {
+      for (int32_t ch = 0; ch < ch_num; ch++)
+        pxtnMix_Add(&p_slots[(par->slot_of_group[g] * ch_num + ch) *
+                                 _moo_WINDOW_SMP +
+                             seg->done_num],
+                    &p_groups[(g * ch_num + ch) * pxtnBUFSIZE_MOOBLOCK], done);
+    }
+    seg->done_num += done;
+    if (done < req) break;
+  }
+}
+
+// Runs the delays of one slot's group over one channel of the window. The
+// delay lines of each channel are separate, and the offsets only move on
+// once all of them are done.
+void pxtnService::_moo_Delay_Task(void* user, int32_t index) {
+  const _MOOPARALLEL* par = (const _MOOPARALLEL*)user;
+  const pxtnService* pxtn = par->pxtn;
+  _MOOWINDOW* win = par->p_delay;
+  int32_t ch_num = pxtn->_dst_ch_num;
+  int32_t slot = index / ch_num + 1;
+  int32_t ch = index % ch_num;
+  int32_t* p_smps = &win->slots[(slot * ch_num + ch) * _moo_WINDOW_SMP];
+
+  for (size_t d = 0; d < pxtn->_delays.size(); d++) {
+    if (par->slot_of_group[pxtn->_delays[d].get_group()] != slot) continue;
+    par->p_moo->delays[d].Tone_Supple_Block(pxtn->_delays[d], ch, p_smps,
+                                            win->smp_num);
+  }
+}
+
+void pxtnService::_moo_Mix_Task(void* user, int32_t index) {
+  const _MOOPARALLEL* par = (const _MOOPARALLEL*)user;
+  _MOOWINDOW* win = par->p_mix;
+  int32_t ch_num = par->pxtn->_dst_ch_num;
+  int32_t begin = index * _moo_SEGMENT_SMP;
+  int32_t end = begin + _moo_SEGMENT_SMP;
+  if (end > win->smp_num) end = win->smp_num;
+  float* p_f32 =
+      &par->p_buf[(win->seg_begin * _moo_SEGMENT_SMP + begin) * ch_num];
+  int32_t work[pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL];
+
+  for (int32_t j = begin; j < end; j += pxtnBUFSIZE_MOOBLOCK) {
+    int32_t n = end - j;
+    if (n > pxtnBUFSIZE_MOOBLOCK) n = pxtnBUFSIZE_MOOBLOCK;
+    for (int32_t ch = 0; ch < ch_num; ch++) {
+      const int32_t* p_src = &win->slots[ch * _moo_WINDOW_SMP + j];
+      for (int32_t i = 0; i < n; i++) work[i * ch_num + ch] = p_src[i];
+      for (int32_t slot = 1; slot < par->slot_num; slot++) {
+        p_src = &win->slots[(slot * ch_num + ch) * _moo_WINDOW_SMP + j];
+        for (int32_t i = 0; i < n; i++) work[i * ch_num + ch] += p_src[i];
+      }
+    }
+    _moo_ToF32(work, p_f32, n * ch_num, par->p_moo->params, par->limit);
+    p_f32 += n * ch_num;
+  }
+}
+
+void pxtnService::_moo_Parallel_Task(void* user, int32_t index) {
+  const _MOOPARALLEL* par = (const _MOOPARALLEL*)user;
+  // The delays and the dry runs take longest, so they go first.
+  int32_t num = par->p_delay ? (par->slot_num - 1) * par->pxtn->_dst_ch_num : 0;
+  if (index < num) return _moo_Delay_Task(user, index);
+  index -= num;
+  num = par->p_dry ? par->dry_num : 0;
+  if (index < num) return _moo_Dry_Task(user, index);
+  index -= num;
+  num = par->p_render ? par->p_render->seg_num : 0;
+  if (index < num) return _moo_Segment_Task(user, index);
+  _moo_Mix_Task(user, index - num);
+}
+
+bool pxtnService::Moo_f32_Parallel(mooState& moo_state, float* p_buf,
+                                   int32_t smp_num, int32_t* filled_num,
+                                   pxtnMOOLIMIT limit) const {
+  // A fade scales the mix sample by sample, after the delays.
+  if (moo_state.fade_fade || smp_num < _moo_SEGMENT_SMP * 2)
+    return Moo_f32(moo_state, p_buf, smp_num, filled_num, limit);
+
+  if (filled_num) *filled_num = 0;
+
+  if (!_moo_b_valid_data) return false;
+  if (moo_state.end_vomit) return false;
+
+  int32_t ch_num = _dst_ch_num;
+  int32_t seg_num = (smp_num + _moo_SEGMENT_SMP - 1) / _moo_SEGMENT_SMP;
+  _MOOPARALLEL par = {};
+  par.pxtn = this;
+  par.p_moo = &moo_state;
+  par.p_buf = p_buf;
+  par.limit = limit;
+  par.smp_num = smp_num;
+  par.end_seg = seg_num;
+
+  // Delays feed back on themselves, so a delay line at some point depends on
+  // everything before it. They are left out of the segments.
+  par.slot_num = 1;
+  for (size_t d = 0; d < _delays.size(); d++) {
+    int32_t g = _delays[d].get_group();
+    if (!par.slot_of_group[g]) par.slot_of_group[g] = par.slot_num++;
+  }
+
+  std::unique_ptr<_MOOWINDOW[]> wins(new _MOOWINDOW[4]);
+  for (int32_t w = 0; w < 4; w++)
+    wins[w].slots.resize((size_t)par.slot_num * ch_num * _moo_WINDOW_SMP);
+
+  // Nor do the segments' states need copies of the delay lines.
+  mooState start;
+  {
+    std::vector<pxtnDelayTone> delays;
+    delays.swap(moo_state.delays);
+    start = moo_state;
+    delays.swap(moo_state.delays);
+  }
+
+  int32_t unit_num = (int32_t)moo_state.units.size();
+  par.dry_num = unit_num > 1 ? unit_num : 1;
+  std::vector<mooState> drys(par.dry_num, start);
+  std::vector<int32_t> dry_smps(par.dry_num, 0);
+  std::vector<std::vector<pxtnUnitTone>> tones(par.dry_num);
+  for (int32_t u = 1; u < par.dry_num; u++)
+    tones[u].resize(_moo_WINDOW_SEG * 2, pxtnUnitTone(NULL));
+  par.drys = drys.data();
+  par.dry_smps = dry_smps.data();
+  par.tones = tones.data();
+
+  pxtnTaskRunner runner = _task_runner ? _task_runner : pxtnTask_Run_Threads;
+  int32_t win_end = (seg_num + _moo_WINDOW_SEG - 1) / _moo_WINDOW_SEG;
+  int32_t smp_w = 0;
+  for (int32_t r = 0; r - 3 < win_end; r++) {
+    // Window r is dry-run, r - 1 rendered, r - 2 delayed and r - 3 mixed.
+    par.p_dry = r < win_end ? &wins[r % 4] : NULL;
+    par.p_render = r - 1 >= 0 && r - 1 < win_end ? &wins[(r - 1) % 4] : NULL;
+    par.p_delay = r - 2 >= 0 && r - 2 < win_end ? &wins[(r - 2) % 4] : NULL;
+    par.p_mix = r - 3 >= 0 && r - 3 < win_end ? &wins[(r - 3) % 4] : NULL;
+
+    int32_t task_num = 0;
+    if (par.p_dry) {
+      _MOOWINDOW* win = par.p_dry;
+      win->seg_begin = r * _moo_WINDOW_SEG;
+      win->seg_num = seg_num - win->seg_begin;
+      if (win->seg_num > _moo_WINDOW_SEG) win->seg_num = _moo_WINDOW_SEG;
+      if (!r) {
+        win->segs[0].state = start;
+        win->segs[0].preroll_num = 0;
+      }
+      task_num += par.dry_num;
+    }
+    if (par.p_render) task_num += par.p_render->seg_num;
+    if (par.p_delay) task_num += (par.slot_num - 1) * ch_num;
+    if (par.p_mix) {
+      task_num += (par.p_mix->smp_num + _moo_SEGMENT_SMP - 1) /
+                  _moo_SEGMENT_SMP;
+    }
+    runner(_task_runner_user, _moo_Parallel_Task, &par, task_num);
+
+    if (par.p_delay) {
+      for (size_t d = 0; d < moo_state.delays.size(); d++)
+        moo_state.delays[d].Tone_Increment_Block(par.p_delay->smp_num);
+    }
+
+    // The song ends within the segments the dry run didn't get to.
+    if (win_end > (par.end_seg + _moo_WINDOW_SEG - 1) / _moo_WINDOW_SEG)
+      win_end = (par.end_seg + _moo_WINDOW_SEG - 1) / _moo_WINDOW_SEG;
+
+    // The units the other dry runs stepped go into the first one's states.
+    _MOOWINDOW* win = par.p_dry;
+    if (win && r < win_end) {
+      if (win->seg_num > par.end_seg - win->seg_begin)
+        win->seg_num = par.end_seg - win->seg_begin;
+      for (int32_t k = 0; k < win->seg_num; k++) {
+        _MOOSEGMENT& seg = win->segs[k];
+        int32_t g = win->seg_begin + k;
+        seg.smp_num = smp_num - g * _moo_SEGMENT_SMP;
+        if (seg.smp_num > _moo_SEGMENT_SMP) seg.smp_num = _moo_SEGMENT_SMP;
+        if (!g) continue;
+        seg.preroll_num = pxtnBUFSIZE_TIMEPAN;
+        for (int32_t u = 1; u < par.dry_num; u++) {
+          seg.state.units[u] = tones[u][k * 2];
+          if (seg.state.loop.units.size() > (size_t)u)
+            seg.state.loop.units[u] = tones[u][k * 2 + 1];
+        }
+      }
+    }
+
+    win = par.p_render;
+    if (win && r - 1 < win_end) {
+      win->smp_num = 0;
+      int32_t k = 0;
+      for (; k < win->seg_num; k++) {
+        _MOOSEGMENT& seg = win->segs[k];
+        win->smp_num += seg.done_num;
+        if (seg.done_num < seg.smp_num) {
+          win_end = r;
+          break;
+        }
+      }
+      smp_w += win->smp_num;
+
+      // The units of the segment that gets furthest carry on in
+      // [moo_state], whose delays catch up with them in the next rounds.
+      if (win_end == r || win->seg_begin + win->seg_num == seg_num) {
+        mooState& end = win->segs[k < win->seg_num ? k : k - 1].state;
+        moo_state.units.swap(end.units);
+        std::swap(moo_state.loop, end.loop);
+        moo_state.loop_catch_up_smp = end.loop_catch_up_smp;
+        moo_state.time_pan_index = end.time_pan_index;
+        moo_state.smp_count = end.smp_count;
+        moo_state.eve_index = end.eve_index;
+        moo_state.num_loop = end.num_loop;
+      }
+    }
+  }
+
+  if (smp_w < smp_num) moo_state.end_vomit = true;
+  if (filled_num) *filled_num = smp_w;
+  for (float* p_f32 = &p_buf[smp_w * ch_num]; smp_w < smp_num; smp_w++) {
+    for (int ch = 0; ch < ch_num; ch++) *p_f32++ = 0;
+  }
+
+  if (_sampled_proc) {
+    if (!_sampled_proc(_sampled_user, this)) {
+      moo_state.end_vomit = true;
+      return false;
+    }
+  }
+  return true;
+}
+
 int32_t pxtnService_moo_CalcSampleNum(int32_t meas_num, int32_t beat_num,
                                       int32_t sps, float beat_tempo) {
   uint32_t total_beat_num;
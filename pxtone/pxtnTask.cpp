@@ -0,0 +1,38 @@
+#include "./pxtnTask.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void pxtnTask_Run_Serial(void *runner_user, pxtnTaskProc proc, void *user,
+                         int32_t task_num) {
+  (void)runner_user;
+  for (int32_t i = 0; i < task_num; i++) proc(user, i);
+}
+
+static void _Take_Tasks(std::atomic<int32_t> *next, pxtnTaskProc proc,
+                        void *user, int32_t task_num) {
+  for (;;) {
+    int32_t i = next->fetch_add(1, std::memory_order_relaxed);
+    if (i >= task_num) break;
+    proc(user, i);
+  }
+}
+
+void pxtnTask_Run_Threads(void *runner_user, pxtnTaskProc proc, void *user,
+                          int32_t task_num) {
+  int32_t thread_num = (int32_t)std::thread::hardware_concurrency();
+  if (thread_num > task_num) thread_num = task_num;
+  if (thread_num <= 1) {
+    pxtnTask_Run_Serial(runner_user, proc, user, task_num);
+    return;
+  }
+
+  std::atomic<int32_t> next(0);
+  std::vector<std::thread> helpers;
+  helpers.reserve(thread_num - 1);
+  for (int32_t t = 1; t < thread_num; t++)
+    helpers.emplace_back(_Take_Tasks, &next, proc, user, task_num);
+  _Take_Tasks(&next, proc, user, task_num);
+  for (std::thread &h : helpers) h.join();
+}
@@ -0,0 +1,28 @@
+// pxtnTask: runs independent jobs, such as readying woices, on several
+// threads.
+
+#ifndef pxtnTask_H
+#define pxtnTask_H
+
+#include "./pxtn.h"
+
+typedef void (*pxtnTaskProc)(void *user, int32_t index);
+
+// Calls proc(user, i) once for every i in [0, task_num), in any order and on
+// any thread, and returns once all of them have finished. Hosts with their own
+// thread pool (e.g. Godot's WorkerThreadPool) give one of these to
+// pxtnService::set_task_runner.
+typedef void (*pxtnTaskRunner)(void *runner_user, pxtnTaskProc proc,
+                               void *user, int32_t task_num);
+
+// The default runner. The calling thread and up to
+// std::thread::hardware_concurrency() - 1 helper threads each take the next
+// unclaimed index until none is left, so a slow task doesn't hold up the
+// ones queued behind it.
+void pxtnTask_Run_Threads(void *runner_user, pxtnTaskProc proc, void *user,
+                          int32_t task_num);
+// Runs every task on the calling thread, in order.
+void pxtnTask_Run_Serial(void *runner_user, pxtnTaskProc proc, void *user,
+                         int32_t task_num);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "./pxtn.h"
 #include "./pxtnEvelist.h"
+#include "./pxtnMix.h"
 
 pxtnUnit::pxtnUnit() {
   _bPlayed = true;
@@ -16,12 +17,18 @@ pxtnUnit::pxtnUnit() {
 pxtnUnit::~pxtnUnit() {}
 
 pxtnUnitTone::pxtnUnitTone(std::shared_ptr<const pxtnWoice> p_woice) {
+  // if (!set_woice(p_woice, true)) throw "Voice is null";
+  Tone_Init(p_woice);  // todo handle it without exceptions
+}
+
+bool pxtnUnitTone::Tone_Init(const std::shared_ptr<const pxtnWoice> &p_woice) {
   _v_GROUPNO = EVENTDEFAULT_GROUPNO;
   _v_VELOCITY = EVENTDEFAULT_VELOCITY;
   _v_VOLUME = EVENTDEFAULT_VOLUME;
   _v_TUNING = EVENTDEFAULT_TUNING;
   _portament_sample_num = 0;
   _portament_sample_pos = 0;
+  _b_woice_pending = false;
   Tone_Clear();
 
   for (int32_t i = 0; i < pxtnMAX_CHANNEL; i++) {
@@ -29,13 +36,37 @@ pxtnUnitTone::pxtnUnitTone(std::shared_ptr<const pxtnWoice> p_woice) {
     _pan_times[i] = 0;
   }
 
-  // if (!set_woice(p_woice, true)) throw "Voice is null";
-  set_woice(p_woice, true); // todo handle it without exceptions
+  if (!p_woice) return false;
+  if (_p_woice != p_woice) _p_woice = p_woice;
+  _key_now = EVENTDEFAULT_KEY;
+  _key_margin = 0;
+  _key_start = EVENTDEFAULT_KEY;
+  return true;
+}
+
+void pxtnUnitTone::Tone_Restore(const pxtnUnitTone &src) {
+  _key_now = src._key_now;
+  _key_start = src._key_start;
+  _key_margin = src._key_margin;
+  _portament_sample_pos = src._portament_sample_pos;
+  _portament_sample_num = src._portament_sample_num;
+  memcpy(_pan_vols, src._pan_vols, sizeof(_pan_vols));
+  memcpy(_pan_times, src._pan_times, sizeof(_pan_times));
+  memcpy(_pan_time_bufs, src._pan_time_bufs, sizeof(_pan_time_bufs));
+  _v_VOLUME = src._v_VOLUME;
+  _v_VELOCITY = src._v_VELOCITY;
+  _v_GROUPNO = src._v_GROUPNO;
+  _v_TUNING = src._v_TUNING;
+  _quiet_smp_num = src._quiet_smp_num;
+  _b_woice_pending = src._b_woice_pending;
+  if (_p_woice != src._p_woice) _p_woice = src._p_woice;
+  for (int32_t v = 0; v < pxtnMAX_UNITCONTROLVOICE; v++) _vts[v] = src._vts[v];
 }
 
 void pxtnUnitTone::Tone_Clear() {
   memset(_pan_time_bufs, 0,
          sizeof(int) * pxtnBUFSIZE_TIMEPAN * pxtnMAX_CHANNEL);
+  _quiet_smp_num = pxtnBUFSIZE_TIMEPAN;
 }
 
 void pxtnUnitTone::Tone_Reset_and_2prm(int32_t voice_idx, int32_t env_rls_clock,
@@ -76,6 +107,14 @@ void pxtnUnitTone::Tone_Reset_Custom(float tempo, float clock_rate,
 }
 
 void pxtnUnitTone::Tone_Reset(float tempo, float clock_rate) {
+  // Nothing of a woice that is still being readied may be read, and its
+  // voices can't sound yet anyway.
+  _b_woice_pending = _p_woice && !_p_woice->is_tone_ready();
+  if (_b_woice_pending) {
+    for (int32_t v = 0; v < pxtnMAX_UNITCONTROLVOICE; v++)
+      _vts[v] = pxtnVOICETONE(0, 0, false);
+    return;
+  }
   Tone_Reset_Custom(tempo, clock_rate, _vts);
 }
 
@@ -167,34 +206,69 @@ void pxtnUnitTone::Tone_Volume(int32_t val) { _v_VOLUME = val; }
 void pxtnUnitTone::Tone_Portament(int32_t val) { _portament_sample_num = val; }
 void pxtnUnitTone::Tone_GroupNo(int32_t val) { _v_GROUPNO = val; }
 void pxtnUnitTone::Tone_Tuning(float val) { _v_TUNING = val; }
+static inline void _Envelope_Voice(const pxtnVOICEINSTANCE *p_vi,
+                                   pxtnVOICETONE *p_vt) {
+  if (p_vt->life_count > 0 && p_vi->env_size) {
+    if (p_vt->on_count > 0) {
+      if (p_vt->env_pos < p_vi->env_size) {
+        p_vt->env_volume = p_vi->p_env[p_vt->env_pos];
+        p_vt->env_pos++;
+      }
+    }
+    // release.
+    else {
+      p_vt->env_volume = p_vt->env_start + (0 - p_vt->env_start) *
+                                               p_vt->env_pos /
+                                               p_vi->env_release;
+      p_vt->env_pos++;
+      // TODO: I think I can set life_count to 0 if env_pos > env_release.
+      // But not sure.
+    }
+  }
+}
+
 void pxtnUnitTone::Tone_Envelope_Custom(pxtnVOICETONE *vts) const {
   if (!_p_woice) return;
 
   /* In practice there are at most 2 voice nums */
-  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++) {
-    const pxtnVOICEINSTANCE *p_vi = _p_woice->get_instance(v);
-    pxtnVOICETONE *p_vt = &vts[v];
-
-    if (p_vt->life_count > 0 && p_vi->env_size) {
-      if (p_vt->on_count > 0) {
-        if (p_vt->env_pos < p_vi->env_size) {
-          p_vt->env_volume = p_vi->p_env[p_vt->env_pos];
-          p_vt->env_pos++;
-        }
-      }
-      // release.
-      else {
-        p_vt->env_volume = p_vt->env_start + (0 - p_vt->env_start) *
-                                                 p_vt->env_pos /
-                                                 p_vi->env_release;
-        p_vt->env_pos++;
-        // TODO: I think I can set life_count to 0 if env_pos > env_release.
-        // But not sure.
-      }
+  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++)
+    _Envelope_Voice(_p_woice->get_instance(v), &vts[v]);
+}
+void pxtnUnitTone::Tone_Envelope() { Tone_Envelope_Custom(_vts); }
+
+/* Amplitude of one voice on channel [ch] for the current sample. */
+static inline int32_t _Sample_Voice(int32_t ch, int32_t ch_num,
+                                    int32_t smooth_smp, int32_t velocity,
+                                    int32_t volume, int32_t pan_vol,
+                                    const pxtnVOICEINSTANCE *p_vi,
+                                    uint32_t voice_flags,
+                                    const pxtnVOICETONE *p_vt) {
+  int32_t work = 0;
+
+  if (p_vt->life_count > 0) {
+    int32_t l, r;
+    pxtnVoice_GetFrame(p_vi, (int32_t)p_vt->smp_pos, &l, &r);
+    work = ch ? r : l;
+
+    /* if we're outputing to mono, get both L and R and avg */
+    /* since this block will only be called to fill one buffer I think? */
+    if (ch_num == 1) work = (l + r) / 2;
+
+    /* scaling filters */
+    work = (work * velocity) / 128;
+    work = (work * volume) / 128;
+    work = work * pan_vol / 64;
+
+    if (p_vi->env_size)
+      work = work * p_vt->env_volume / 128; /* ENVELOPE!! */
+
+    // smooth tail
+    if (voice_flags & PTV_VOICEFLAG_SMOOTH && p_vt->life_count < smooth_smp) {
+      work = work * p_vt->life_count / smooth_smp;
     }
   }
+  return work;
 }
-void pxtnUnitTone::Tone_Envelope() { Tone_Envelope_Custom(_vts); }
 
 /* This sets up the buffers local to the unit for time pans (_pan_time_bufs)
  */
@@ -207,60 +281,54 @@ void pxtnUnitTone::Tone_Sample_Custom(int32_t ch_num, int32_t smooth_smp,
 
     for (int32_t v = 0; v < _p_woice->get_voice_num(); v++) {
       /* tone represents configuration (e.g. wave offset) particular voice for
-       * this unit */
-      pxtnVOICETONE *p_vt = &vts[v];
-      /* instance is the actual sample data */
-      const pxtnVOICEINSTANCE *p_vi = _p_woice->get_instance(v);
-
-      int32_t work = 0;
-
-      if (p_vt->life_count > 0) {
-        /* this smp_pos buffer alternates between left and right amps */
-        /* Bytes: LLRRLLRR, increasing in time, I think. */
-        int32_t pos = (int32_t)p_vt->smp_pos * 4 + ch * 2;
-        work += *((short *)&p_vi->p_smp_w[pos]); /* syntax just means read the
-                                                    thing at pos as short */
-
-        /* if we're outputing to mono, get both L and R and avg */
-        /* since this block will only be called to fill one buffer I think? */
-        if (ch_num == 1) {
-          work += *((short *)&p_vi->p_smp_w[pos + 2]);
-          work = work / 2;
-        }
-
-        /* scaling filters */
-        work = (work * _v_VELOCITY) / 128;
-        work = (work * _v_VOLUME) / 128;
-        work = work * _pan_vols[ch] / 64;
-
-        if (p_vi->env_size)
-          work = work * p_vt->env_volume / 128; /* ENVELOPE!! */
-
-        // smooth tail
-        if (_p_woice->get_voice(v)->voice_flags & PTV_VOICEFLAG_SMOOTH &&
-            p_vt->life_count < smooth_smp) {
-          work = work * p_vt->life_count / smooth_smp;
-        }
-      }
-      time_pan_buf += work;
+       * this unit. instance is the actual sample data */
+      time_pan_buf += _Sample_Voice(
+          ch, ch_num, smooth_smp, _v_VELOCITY, _v_VOLUME, _pan_vols[ch],
+          _p_woice->get_instance(v), _p_woice->get_voice(v)->voice_flags,
+          &vts[v]);
     }
     bufs[ch] = time_pan_buf;
   }
 }
 
-void pxtnUnitTone::Tone_Sample(bool b_mute, int32_t ch_num,
-                               int32_t time_pan_index, int32_t smooth_smp) {
+static inline bool _Voices_Alive(const pxtnVOICETONE *vts, int32_t voice_num) {
+  for (int32_t v = 0; v < voice_num; v++)
+    if (vts[v].life_count > 0) return true;
+  return false;
+}
+
+void pxtnUnitTone::Tone_Sample_Dry(bool b_mute, int32_t ch_num,
+                                   int32_t time_pan_index) {
   if (!_p_woice) return;
 
-  if (b_mute) {
-    for (int32_t ch = 0; ch < ch_num; ch++)
-      _pan_time_bufs[time_pan_index][ch] = 0;
-    return;
-  }
+  if (b_mute || !_Voices_Alive(_vts, _p_woice->get_voice_num())) {
+    if (_quiet_smp_num < pxtnBUFSIZE_TIMEPAN) _quiet_smp_num++;
+  } else
+    _quiet_smp_num = 0;
+
+  for (int32_t ch = 0; ch < ch_num; ch++)
+    _pan_time_bufs[time_pan_index][ch] = 0;
+}
+
+void pxtnUnitTone::Tone_Sample(bool b_mute, int32_t ch_num,
+                               int32_t time_pan_index, int32_t smooth_smp) {
+  Tone_Sample_Dry(b_mute, ch_num, time_pan_index);
+  if (!_p_woice || b_mute) return;
 
   Tone_Sample_Custom(ch_num, smooth_smp, _vts, _pan_time_bufs[time_pan_index]);
 }
 
+bool pxtnUnitTone::Tone_IsSilent() const {
+  if (_quiet_smp_num < pxtnBUFSIZE_TIMEPAN) return false;
+  return !_p_woice || !_Voices_Alive(_vts, _p_woice->get_voice_num());
+}
+
+void pxtnUnitTone::Tone_Skip(int32_t smp_num) {
+  // With no voice alive, envelopes, samples and positions don't move and the
+  // time-pan buffer stays zero. Only the key can still slide.
+  Tone_Increment_Key_Skip(smp_num);
+}
+
 int32_t pxtnUnitTone::Tone_Supple_get(int32_t ch,
                                       int32_t time_pan_index) const {
   int32_t idx = (time_pan_index - _pan_times[ch]) & (pxtnBUFSIZE_TIMEPAN - 1);
@@ -295,44 +363,295 @@ int pxtnUnitTone::Tone_Increment_Key() {
   return _key_now;
 }
 
+static inline void _Increment_Voice(float freq, float tuning,
+                                    const pxtnVOICEINSTANCE *p_vi,
+                                    uint32_t voice_flags, pxtnVOICETONE *p_vt) {
+  if (p_vt->life_count > 0) p_vt->life_count--;
+  if (p_vt->life_count > 0) {
+    p_vt->on_count--;
+
+    p_vt->smp_pos += p_vt->offset_freq * tuning * freq;
+
+    if (p_vt->smp_pos >= p_vi->smp_body_w) {
+      if (voice_flags & PTV_VOICEFLAG_WAVELOOP) {
+        if (p_vt->smp_pos >= p_vi->smp_body_w)
+          p_vt->smp_pos -= p_vi->smp_body_w;
+        if (p_vt->smp_pos >= p_vi->smp_body_w) p_vt->smp_pos = 0;
+      } else {
+        p_vt->life_count = 0;
+      }
+    }
+
+    // OFF
+    if (p_vt->on_count == 0 && p_vi->env_size) {
+      p_vt->env_start = p_vt->env_volume;
+      p_vt->env_pos = 0;
+    }
+  }
+}
+
+void pxtnUnitTone::Tone_Increment_Key_Skip(int32_t smp_num) {
+  if (smp_num <= 0) return;
+  if (_portament_sample_num && _key_margin) {
+    int32_t remain = _portament_sample_num - 1 - _portament_sample_pos;
+    if (remain < 0) remain = 0;
+    if (smp_num <= remain) {
+      _portament_sample_pos += smp_num;
+      _key_now =
+          (int32_t)(_key_start + (double)_key_margin * _portament_sample_pos /
+                                     _portament_sample_num);
+      return;
+    }
+    // The portamento ends within the skipped samples.
+    _portament_sample_pos += remain;
+    _key_now = _key_start + _key_margin;
+    _key_start = _key_now;
+    _key_margin = 0;
+    return;
+  }
+  _key_now = _key_start + _key_margin;
+}
+
 void pxtnUnitTone::Tone_Increment_Sample_Custom(float freq,
                                                 pxtnVOICETONE *vts) const {
   if (!_p_woice) return;
 
   /* Up to two voices (the ones you see in ptvoice) */
-  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++) {
-    const pxtnVOICEINSTANCE *p_vi = _p_woice->get_instance(v);
-    pxtnVOICETONE *p_vt = &vts[v];
-
-    if (p_vt->life_count > 0) p_vt->life_count--;
-    if (p_vt->life_count > 0) {
-      p_vt->on_count--;
-
-      p_vt->smp_pos += p_vt->offset_freq * _v_TUNING * freq;
-
-      if (p_vt->smp_pos >= p_vi->smp_body_w) {
-        if (_p_woice->get_voice(v)->voice_flags & PTV_VOICEFLAG_WAVELOOP) {
-          if (p_vt->smp_pos >= p_vi->smp_body_w)
-            p_vt->smp_pos -= p_vi->smp_body_w;
-          if (p_vt->smp_pos >= p_vi->smp_body_w) p_vt->smp_pos = 0;
-        } else {
-          p_vt->life_count = 0;
+  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++)
+    _Increment_Voice(freq, _v_TUNING, _p_woice->get_instance(v),
+                     _p_woice->get_voice(v)->voice_flags, &vts[v]);
+}
+
+void pxtnUnitTone::Tone_Increment_Sample(float freq) {
+  Tone_Increment_Sample_Custom(freq, _vts);
+}
+
+void pxtnUnitTone::Tone_Render(bool b_mute, int32_t ch_num,
+                               int32_t time_pan_index, int32_t smooth_smp,
+                               float smp_stride, int32_t *group_smps,
+                               int32_t smp_num) {
+  /* Gives the same result as [smp_num] samples of _moo_PXTONE_SAMPLE. Units
+   * don't affect each other until the groups are summed, and a unit's voices
+   * don't affect each other either, so each voice runs through the whole
+   * block on its own. The scalar part only steps the voice and reads its
+   * wave. The gain chain and the sums then run over whole spans with the
+   * pxtnMix kernels. */
+  const pxtnWoice *p_wc = _p_woice.get();
+  int32_t voice_num = p_wc ? p_wc->get_voice_num() : 0;
+
+  int32_t keys[pxtnBUFSIZE_MOOBLOCK];
+  float freqs[pxtnBUFSIZE_MOOBLOCK];
+  int32_t freq_num = 0;
+  for (int32_t i = 0; i < smp_num; i++) keys[i] = Tone_Increment_Key();
+
+  // [outs] is what this unit writes to the time-pan buffer for each sample.
+  int32_t outs[pxtnMAX_CHANNEL][pxtnBUFSIZE_MOOBLOCK];
+  int32_t works[pxtnMAX_CHANNEL][pxtnBUFSIZE_MOOBLOCK];
+  int32_t envs[pxtnBUFSIZE_MOOBLOCK];
+  int32_t lifes[pxtnBUFSIZE_MOOBLOCK];
+  int32_t live_max = 0;
+
+  if (p_wc) {
+    for (int32_t ch = 0; ch < ch_num; ch++)
+      memset(outs[ch], 0, sizeof(int32_t) * smp_num);
+  }
+
+  for (int32_t v = 0; v < voice_num; v++) {
+    const pxtnVOICEINSTANCE *p_vi = p_wc->get_instance(v);
+    uint32_t voice_flags = p_wc->get_voice(v)->voice_flags;
+    pxtnVOICETONE *p_vt = &_vts[v];
+
+    // Once a voice has run out it stays silent until the next ON event.
+    int32_t live = 0;
+    for (; live < smp_num; live++) {
+      _Envelope_Voice(p_vi, p_vt);
+      if (p_vt->life_count <= 0) break;
+
+      if (!b_mute) {
+        int32_t l, r;
+        pxtnVoice_GetFrame(p_vi, (int32_t)p_vt->smp_pos, &l, &r);
+        if (ch_num == 1)
+          works[0][live] = (l + r) / 2;
+        else {
+          works[0][live] = l;
+          works[1][live] = r;
         }
+        envs[live] = p_vt->env_volume;
+        lifes[live] = p_vt->life_count;
+      }
+
+      if (live >= freq_num) {
+        freqs[live] = pxtnPulse_Frequency::Get2(keys[live]) * smp_stride;
+        freq_num = live + 1;
+      }
+      _Increment_Voice(freqs[live], _v_TUNING, p_vi, voice_flags, p_vt);
+    }
+    if (live > live_max) live_max = live;
+    if (b_mute || !live) continue;
+
+    for (int32_t ch = 0; ch < ch_num; ch++) {
+      int32_t *p_work = works[ch];
+      pxtnMix_Gain(p_work, live, _v_VELOCITY, _v_VOLUME, _pan_vols[ch],
+                   p_vi->env_size ? envs : NULL);
+      // smooth tail
+      if (voice_flags & PTV_VOICEFLAG_SMOOTH) {
+        for (int32_t i = 0; i < live; i++)
+          if (lifes[i] < smooth_smp)
+            p_work[i] = p_work[i] * lifes[i] / smooth_smp;
       }
+      pxtnMix_Add(outs[ch], p_work, live);
+    }
+  }
+
+  if (p_wc) {
+    if (b_mute || !live_max)
+      _quiet_smp_num += smp_num;
+    else
+      _quiet_smp_num = smp_num - live_max;
+    if (_quiet_smp_num > pxtnBUFSIZE_TIMEPAN)
+      _quiet_smp_num = pxtnBUFSIZE_TIMEPAN;
+  }
+
+  for (int32_t ch = 0; ch < ch_num; ch++) {
+    int32_t *p_dst =
+        &group_smps[(_v_GROUPNO * ch_num + ch) * pxtnBUFSIZE_MOOBLOCK];
+
+    // The first samples of the block come out of the time-pan buffer.
+    int32_t delay = _pan_times[ch];
+    if (delay > smp_num || !p_wc) delay = smp_num;
+    for (int32_t i = 0; i < delay; i++)
+      p_dst[i] += Tone_Supple_get(ch, time_pan_index + i);
+    if (!p_wc) continue;
+    pxtnMix_Add(&p_dst[delay], outs[ch], smp_num - delay);
+
+    // The buffer keeps the last pxtnBUFSIZE_TIMEPAN samples written.
+    int32_t i = smp_num - pxtnBUFSIZE_TIMEPAN;
+    if (i < 0) i = 0;
+    for (; i < smp_num; i++)
+      _pan_time_bufs[(time_pan_index + i) & (pxtnBUFSIZE_TIMEPAN - 1)][ch] =
+          outs[ch][i];
+  }
+}
 
-      // OFF
-      if (p_vt->on_count == 0 && p_vi->env_size) {
-        p_vt->env_start = p_vt->env_volume;
-        p_vt->env_pos = 0;
+/* [smp_num] samples of a voice, as _Envelope_Voice and _Increment_Voice
+ * would go through them, at [freqs] or at a steady [freq] without. Up to its
+ * release or the end of its life, the counts and the envelope of a voice
+ * move in step, so they're worked out once for the whole stretch. Only the
+ * wave position is stepped sample by sample, since its rounding depends on
+ * every step. Returns for how many samples the voice was alive. */
+static int32_t _Advance_Voice(float tuning, const float *freqs, float freq,
+                              const pxtnVOICEINSTANCE *p_vi,
+                              uint32_t voice_flags, pxtnVOICETONE *p_vt,
+                              int32_t smp_num) {
+  int32_t i = 0;
+  while (i < smp_num && p_vt->life_count > 0) {
+    // A stretch ends at the release or at the end of the voice's life.
+    int32_t n = smp_num - i;
+    bool b_on = p_vt->on_count > 0;
+    if (b_on && n > p_vt->on_count) n = p_vt->on_count;
+    if (n > p_vt->life_count) n = p_vt->life_count;
+
+    // The last sample of a life doesn't step the wave.
+    int32_t step_num = n == p_vt->life_count ? n - 1 : n;
+    int32_t step = 0;
+    bool b_died = false;
+    double smp_pos = p_vt->smp_pos;
+    double body_w = p_vi->smp_body_w;
+    bool b_loop = voice_flags & PTV_VOICEFLAG_WAVELOOP;
+    float inc = p_vt->offset_freq * tuning * freq;
+    for (; step < step_num; step++) {
+      if (freqs) inc = p_vt->offset_freq * tuning * freqs[i + step];
+      smp_pos += inc;
+      if (smp_pos >= body_w) {
+        if (!b_loop) {
+          b_died = true;
+          break;
+        }
+        smp_pos -= body_w;
+        if (smp_pos >= body_w) smp_pos = 0;
+      }
+    }
+    p_vt->smp_pos = smp_pos;
+
+    // The envelope runs once for each sample the voice started alive.
+    int32_t env_num = b_died ? step + 1 : n;
+    if (p_vi->env_size) {
+      if (b_on) {
+        int32_t env_num_on = p_vi->env_size - p_vt->env_pos;
+        if (env_num_on > env_num) env_num_on = env_num;
+        if (env_num_on > 0) {
+          p_vt->env_pos += env_num_on;
+          p_vt->env_volume = p_vi->p_env[p_vt->env_pos - 1];
+        }
+      } else {
+        p_vt->env_pos += env_num;
+        p_vt->env_volume = p_vt->env_start + (0 - p_vt->env_start) *
+                                                 (p_vt->env_pos - 1) /
+                                                 p_vi->env_release;
       }
     }
+
+    if (b_died) {
+      p_vt->life_count = 0;
+      p_vt->on_count -= step + 1;
+    } else {
+      p_vt->life_count -= n;
+      p_vt->on_count -= step_num;
+    }
+    // OFF
+    if (b_on && p_vt->on_count == 0 && p_vi->env_size) {
+      p_vt->env_start = p_vt->env_volume;
+      p_vt->env_pos = 0;
+    }
+    i += env_num;
   }
+  return i;
 }
 
-void pxtnUnitTone::Tone_Increment_Sample(float freq) {
-  Tone_Increment_Sample_Custom(freq, _vts);
+void pxtnUnitTone::Tone_Advance(bool b_mute, float smp_stride,
+                                int32_t smp_num) {
+  const pxtnWoice *p_wc = _p_woice.get();
+  memset(_pan_time_bufs, 0, sizeof(_pan_time_bufs));
+  if (!p_wc) {
+    Tone_Increment_Key_Skip(smp_num);
+    return;
+  }
+
+  for (int32_t done = 0; done < smp_num;) {
+    // During a portamento the key moves every sample, after it not at all.
+    float freqs[pxtnBUFSIZE_MOOBLOCK];
+    const float *p_freqs = NULL;
+    float freq = 0;
+    int32_t n = smp_num - done;
+    if (_portament_sample_num && _key_margin) {
+      if (n > pxtnBUFSIZE_MOOBLOCK) n = pxtnBUFSIZE_MOOBLOCK;
+      for (int32_t i = 0; i < n; i++)
+        freqs[i] =
+            pxtnPulse_Frequency::Get2(Tone_Increment_Key()) * smp_stride;
+      p_freqs = freqs;
+    } else
+      freq = pxtnPulse_Frequency::Get2(Tone_Increment_Key()) * smp_stride;
+
+    int32_t live_max = 0;
+    for (int32_t v = 0; v < p_wc->get_voice_num(); v++) {
+      int32_t live =
+          _Advance_Voice(_v_TUNING, p_freqs, freq, p_wc->get_instance(v),
+                         p_wc->get_voice(v)->voice_flags, &_vts[v], n);
+      if (live > live_max) live_max = live;
+    }
+
+    if (b_mute || !live_max)
+      _quiet_smp_num += n;
+    else
+      _quiet_smp_num = n - live_max;
+    if (_quiet_smp_num > pxtnBUFSIZE_TIMEPAN)
+      _quiet_smp_num = pxtnBUFSIZE_TIMEPAN;
+    done += n;
+  }
 }
 
+bool pxtnUnitTone::is_woice_pending() const { return _b_woice_pending; }
+
 std::shared_ptr<const pxtnWoice> pxtnUnitTone::get_woice() const {
   return _p_woice;
 }
@@ -8,6 +8,9 @@
 #include "./pxtnMax.h"
 #include "./pxtnWoice.h"
 
+// Max number of samples rendered at once between events.
+#define pxtnBUFSIZE_MOOBLOCK 256
+
 /// Note: I extracted out the stuff related to playing a unit into a separate
 /// struct, so that this can be outside of the pxtnService state.
 class pxtnUnitTone {
@@ -28,6 +31,14 @@ class pxtnUnitTone {
   int32_t _v_GROUPNO;
   float _v_TUNING;
 
+  // How many of the latest samples written to _pan_time_bufs were silent,
+  // up to pxtnBUFSIZE_TIMEPAN.
+  int32_t _quiet_smp_num;
+
+  // The woice wasn't ready when it was set, so the voice tones are silent
+  // placeholders until Tone_Reset finds it ready.
+  bool _b_woice_pending;
+
   std::shared_ptr<const pxtnWoice> _p_woice;
 
   pxtnVOICETONE _vts[pxtnMAX_UNITCONTROLVOICE];
@@ -35,6 +46,14 @@ class pxtnUnitTone {
  public:
   pxtnUnitTone(std::shared_ptr<const pxtnWoice> p_woice);
 
+  // Puts the tone back in the state pxtnUnitTone(p_woice) starts in, in place.
+  // The woice is only reassigned if it differs, so restarting a loop neither
+  // allocates nor touches refcounts.
+  bool Tone_Init(const std::shared_ptr<const pxtnWoice> &p_woice);
+  // Copies all of [src]'s playing state, likewise leaving the woice pointer
+  // alone when both play the same woice.
+  void Tone_Restore(const pxtnUnitTone &src);
+
   void Tone_Clear();
 
   void Tone_Reset_and_2prm(int32_t voice_idx, int32_t env_rls_clock,
@@ -60,14 +79,37 @@ class pxtnUnitTone {
                           pxtnVOICETONE *vts, int32_t *bufs) const;
   void Tone_Sample(bool b_mute, int32_t ch_num, int32_t time_pan_index,
                    int32_t smooth_smp);
+  // Tone_Sample for a dry run: keeps count of the quiet samples, but writes
+  // silence to the time-pan buffer.
+  void Tone_Sample_Dry(bool b_mute, int32_t ch_num, int32_t time_pan_index);
   int32_t Tone_Supple_get(int32_t ch, int32_t time_pan_index) const;
   void Tone_Supple(int32_t *group_smps, int32_t ch_num,
                    int32_t time_pan_index) const;
   int32_t Tone_Increment_Key();
+  // Same as calling Tone_Increment_Key [smp_num] times.
+  void Tone_Increment_Key_Skip(int32_t smp_num);
   void Tone_Increment_Sample_Custom(float freq, pxtnVOICETONE *vts) const;
   void Tone_Increment_Sample(float freq);
 
+  // Runs envelope, sample, supple and increments for [smp_num] (at most
+  // pxtnBUFSIZE_MOOBLOCK) samples in a row. Sample i of channel ch is added to
+  // group_smps[(group * ch_num + ch) * pxtnBUFSIZE_MOOBLOCK + i].
+  void Tone_Render(bool b_mute, int32_t ch_num, int32_t time_pan_index,
+                   int32_t smooth_smp, float smp_stride, int32_t *group_smps,
+                   int32_t smp_num);
+  // Tone_Render for a dry run of any length: the voices step on exactly as
+  // they would, and the time-pan buffer is left silent, like after
+  // Tone_Sample_Dry.
+  void Tone_Advance(bool b_mute, float smp_stride, int32_t smp_num);
+
+  // True when no voice is sounding and the time-pan buffer has drained, so
+  // the unit only adds silence until its next ON event.
+  bool Tone_IsSilent() const;
+  // Advances a silent unit by [smp_num] samples without rendering them.
+  void Tone_Skip(int32_t smp_num);
+
   bool set_woice(std::shared_ptr<const pxtnWoice> p_woice, bool resetKey);
+  bool is_woice_pending() const;
   std::shared_ptr<const pxtnWoice> get_woice() const;
 
   pxtnVOICETONE *get_tone(int32_t voice_idx);
@@ -14,6 +14,7 @@ pxtnWoice::pxtnWoice() {
   _type = pxtnWOICE_None;
   _voices = NULL;
   _voinsts = NULL;
+  _b_tone_ready = false;
 }
 
 pxtnWoice::~pxtnWoice() { Voice_Release(); }
@@ -22,6 +23,9 @@ int32_t pxtnWoice::get_voice_num() const { return _voice_num; }
 int32_t pxtnWoice::get_x3x_basic_key() const { return _x3x_basic_key; }
 float pxtnWoice::get_x3x_tuning() const { return _x3x_tuning; }
 pxtnWOICETYPE pxtnWoice::get_type() const { return _type; }
+bool pxtnWoice::is_tone_ready() const {
+  return _b_tone_ready.load(std::memory_order_acquire);
+}
 
 pxtnVOICEUNIT* pxtnWoice::get_voice_variable(int32_t idx) {
   if (idx < 0 || idx >= _voice_num) return NULL;
@@ -54,6 +58,24 @@ bool pxtnWoice::is_name_buf() const {
   return false;
 }
 
+static void _Free_Sample(pxtnVOICEINSTANCE* p_vi) {
+  if (p_vi->p_smp_data) {
+    pxtnWoiceCache_Release(&p_vi->p_smp_data);
+    p_vi->p_smp_w = NULL;
+  } else {
+    pxtnMem_free((void**)&p_vi->p_smp_w);
+  }
+}
+
+static void _Free_Envelope(pxtnVOICEINSTANCE* p_vi) {
+  if (p_vi->p_env_data) {
+    pxtnWoiceCache_Release(&p_vi->p_env_data);
+    p_vi->p_env = NULL;
+  } else {
+    pxtnMem_free((void**)&p_vi->p_env);
+  }
+}
+
 static void _Voice_Release(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi) {
   if (p_vc) {
     SAFE_DELETE(p_vc->p_pcm);
@@ -67,13 +89,14 @@ static void _Voice_Release(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi) {
     memset(&p_vc->wave, 0, sizeof(pxtnVOICEWAVE));
   }
   if (p_vi) {
-    pxtnMem_free((void**)&p_vi->p_env);
-    pxtnMem_free((void**)&p_vi->p_smp_w);
+    _Free_Envelope(p_vi);
+    _Free_Sample(p_vi);
     memset(p_vi, 0, sizeof(pxtnVOICEINSTANCE));
   }
 }
 
 void pxtnWoice::Voice_Release() {
+  _b_tone_ready = false;
   for (int32_t v = 0; v < _voice_num; v++)
     _Voice_Release(&_voices[v], &_voinsts[v]);
   pxtnMem_free((void**)&_voices);
@@ -266,37 +289,70 @@ term:
   return res;
 }
 
-static void _UpdateWavePTV(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi,
-                           int32_t ch, int32_t sps, int32_t bps) {
+// One period of the voice's wave at volume 128.
+static void _Wave_Build(const pxtnVOICEUNIT* p_vc, int32_t smp_num,
+                        double* p_dst) {
+  pxtnPulse_Oscillator osci;
+  osci.ReadyGetSample(p_vc->wave.points, p_vc->wave.num, 128, smp_num,
+                      p_vc->wave.reso);
+  if (p_vc->type == pxtnVOICE_Overtone)
+    osci.GetSamples_Overtone(p_dst);
+  else
+    osci.GetSamples_Coodinate(p_dst);
+}
+
+// The same, shared through pxtnWoiceCache by voices with the same points
+// whatever their volume and pan. NULL when out of memory.
+static const pxtnWOICEDATA* _Wave_Cached(const pxtnVOICEUNIT* p_vc,
+                                         int32_t smp_num) {
+  pxtnWoiceKeyBuilder key('W');
+  key.add_i32(p_vc->type);
+  key.add_i32(smp_num);
+  key.add_i32(p_vc->wave.reso);
+  key.add_points(p_vc->wave.points, p_vc->wave.num);
+  const pxtnWOICEDATA* p_data = pxtnWoiceCache_Find(key.get());
+  if (p_data) return p_data;
+
+  pxtnWOICEDATA data = {NULL, (int32_t)sizeof(double) * smp_num, {0, 0, 0}};
+  if (!pxtnMem_zero_alloc((void**)&data.p_buf, data.size)) return NULL;
+  _Wave_Build(p_vc, smp_num, (double*)data.p_buf);
+  return pxtnWoiceCache_Insert(key.get(), data);
+}
+
+static bool _UpdateWavePTV(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi,
+                           int32_t ch, int32_t sps, int32_t bps,
+                           bool b_cache) {
   (void)sps;
   double work, osc;
   int32_t long_;
   int32_t pan_volume[2] = {64, 64};
-  bool b_ovt;
-
-  pxtnPulse_Oscillator osci;
 
   if (ch == 2) {
     if (p_vc->pan > 64) pan_volume[0] = (128 - p_vc->pan);
     if (p_vc->pan < 64) pan_volume[1] = (p_vc->pan);
   }
 
-  osci.ReadyGetSample(p_vc->wave.points, p_vc->wave.num, p_vc->volume,
-                      p_vi->smp_body_w, p_vc->wave.reso);
-
-  if (p_vc->type == pxtnVOICE_Overtone)
-    b_ovt = true;
-  else
-    b_ovt = false;
+  const pxtnWOICEDATA* p_wave = NULL;
+  double* p_own = NULL;
+  const double* p_osc = NULL;
+  if (b_cache) {
+    if (!(p_wave = _Wave_Cached(p_vc, p_vi->smp_body_w))) return false;
+    p_osc = (const double*)p_wave->p_buf;
+  } else {
+    if (!pxtnMem_zero_alloc((void**)&p_own,
+                            sizeof(double) * p_vi->smp_body_w))
+      return false;
+    _Wave_Build(p_vc, p_vi->smp_body_w, p_own);
+    p_osc = p_own;
+  }
 
+  // Scaling the volume-128 wave by volume / 128 gives exactly what the
+  // oscillator returns for [volume] itself.
   //  8bit
   if (bps == 8) {
     uint8_t* p = (uint8_t*)p_vi->p_smp_w;
     for (int32_t s = 0; s < p_vi->smp_body_w; s++) {
-      if (b_ovt)
-        osc = osci.GetOneSample_Overtone(s);
-      else
-        osc = osci.GetOneSample_Coodinate(s);
+      osc = p_osc[s] * p_vc->volume / 128;
       for (int32_t c = 0; c < ch; c++) {
         work = osc * pan_volume[c] / 64;
         if (work > 1.0) work = 1.0;
@@ -310,10 +366,7 @@ static void _UpdateWavePTV(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi,
   } else {
     int16_t* p = (int16_t*)p_vi->p_smp_w;
     for (int32_t s = 0; s < p_vi->smp_body_w; s++) {
-      if (b_ovt)
-        osc = osci.GetOneSample_Overtone(s);
-      else
-        osc = osci.GetOneSample_Coodinate(s);
+      osc = p_osc[s] * p_vc->volume / 128;
       for (int32_t c = 0; c < ch; c++) {
         work = osc * pan_volume[c] / 64;
         if (work > 1.0) work = 1.0;
@@ -323,9 +376,161 @@ static void _UpdateWavePTV(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi,
       }
     }
   }
+
+  pxtnWoiceCache_Release(&p_wave);
+  pxtnMem_free((void**)&p_own);
+  return true;
 }
 
-pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
+static void _Add_Noise_Osc(pxtnWoiceKeyBuilder* p_key,
+                           const pxNOISEDESIGN_OSCILLATOR* p_osc) {
+  p_key->add_i32(p_osc->type);
+  p_key->add_f32(p_osc->freq);
+  p_key->add_f32(p_osc->volume);
+  p_key->add_f32(p_osc->offset);
+  p_key->add_i32(p_osc->b_rev);
+}
+
+// Everything Tone_Ready_sample reads to build the voice's sample buffer.
+static pxtnWOICEKEY _Sample_Key(const pxtnVOICEUNIT* p_vc, int32_t ch,
+                                int32_t sps, int32_t bps,
+                                pxtnRESAMPLE resample) {
+  pxtnWoiceKeyBuilder key('S');
+  key.add_i32(ch);
+  key.add_i32(sps);
+  key.add_i32(bps);
+  key.add_i32(p_vc->type);
+  // only recorded samples go through the resampler.
+  if (p_vc->type == pxtnVOICE_OggVorbis || p_vc->type == pxtnVOICE_Sampling) {
+    key.add_i32(resample);
+    key.add_i32(p_vc->voice_flags & PTV_VOICEFLAG_WAVELOOP);
+  }
+
+  switch (p_vc->type) {
+    case pxtnVOICE_OggVorbis: {
+#ifdef pxINCLUDE_OGGVORBIS
+      int32_t size = 0;
+      const char* p_data = p_vc->p_oggv->get_p_data(&size);
+      key.add_i32(size);
+      if (p_data) key.add(p_data, size);
+#endif
+      break;
+    }
+    case pxtnVOICE_Sampling: {
+      const pxtnPulse_PCM* p_pcm = p_vc->p_pcm;
+      key.add_i32(p_pcm->get_ch());
+      key.add_i32(p_pcm->get_sps());
+      key.add_i32(p_pcm->get_bps());
+      key.add_i32(p_pcm->get_smp_head());
+      key.add_i32(p_pcm->get_smp_body());
+      key.add_i32(p_pcm->get_smp_tail());
+      if (p_pcm->get_p_buf()) key.add(p_pcm->get_p_buf(), p_pcm->get_buf_size());
+      break;
+    }
+    case pxtnVOICE_Overtone:
+    case pxtnVOICE_Coodinate:
+      key.add_i32(p_vc->volume);
+      key.add_i32(p_vc->pan);
+      key.add_i32(p_vc->wave.reso);
+      key.add_points(p_vc->wave.points, p_vc->wave.num);
+      break;
+    case pxtnVOICE_Noise: {
+      const pxtnPulse_Noise* p_ptn = p_vc->p_ptn;
+      key.add_i32(p_ptn->get_smp_num_44k());
+      key.add_i32(p_ptn->get_unit_num());
+      for (int32_t u = 0; u < p_ptn->get_unit_num(); u++) {
+        const pxNOISEDESIGN_UNIT* p_du = p_ptn->get_unit(u);
+        key.add_i32(p_du->bEnable);
+        key.add_i32(p_du->pan);
+        key.add_points(p_du->enves, p_du->enve_num);
+        _Add_Noise_Osc(&key, &p_du->main);
+        _Add_Noise_Osc(&key, &p_du->freq);
+        _Add_Noise_Osc(&key, &p_du->volu);
+      }
+      break;
+    }
+  }
+  return key.get();
+}
+
+static pxtnWOICEKEY _Envelope_Key(const pxtnVOICEENVELOPE* p_enve,
+                                  int32_t sps) {
+  pxtnWoiceKeyBuilder key('E');
+  key.add_i32(sps);
+  key.add_i32(p_enve->fps);
+  key.add_points(p_enve->points, p_enve->head_num);
+  return key.get();
+}
+
+static void _Use_Sample(pxtnVOICEINSTANCE* p_vi, const pxtnWOICEDATA* p_data) {
+  p_vi->p_smp_data = p_data;
+  p_vi->p_smp_w = p_data->p_buf;
+  p_vi->smp_head_w = p_data->info[0];
+  p_vi->smp_body_w = p_data->info[1];
+  p_vi->smp_tail_w = p_data->info[2];
+  p_vi->smp_ch = p_data->info[3];
+  p_vi->smp_bps = p_data->info[4];
+  p_vi->smp_sps = p_data->info[5];
+  p_vi->smp_num = p_data->info[6];
+}
+
+static void _Set_Format(pxtnVOICEINSTANCE* p_vi, int32_t ch, int32_t sps,
+                        int32_t bps) {
+  p_vi->smp_ch = ch;
+  p_vi->smp_bps = bps;
+  p_vi->smp_sps = sps;
+  p_vi->smp_num = p_vi->smp_head_w + p_vi->smp_body_w + p_vi->smp_tail_w;
+}
+
+// Hands the decoded [p_pcm] over to [p_vi]. The nearest conversion only
+// repeats or drops frames, so the source is kept in its own channels, bits
+// and rate, and pxtnVoice_GetFrame picks the frames the conversion would
+// have. Lengths are still counted at [sps], rounded as the conversion does.
+// Sinc conversion needs the rate converted, but the channels are kept.
+static pxtnWOICEDATA _Sample_Data(pxtnVOICEINSTANCE* p_vi) {
+  pxtnWOICEDATA data;
+  data.p_buf = p_vi->p_smp_w;
+  data.size = p_vi->smp_num * p_vi->smp_ch * p_vi->smp_bps / 8;
+  data.info[0] = p_vi->smp_head_w;
+  data.info[1] = p_vi->smp_body_w;
+  data.info[2] = p_vi->smp_tail_w;
+  data.info[3] = p_vi->smp_ch;
+  data.info[4] = p_vi->smp_bps;
+  data.info[5] = p_vi->smp_sps;
+  data.info[6] = p_vi->smp_num;
+  return data;
+}
+
+static bool _Ready_PCM(pxtnPulse_PCM* p_pcm, pxtnVOICEINSTANCE* p_vi,
+                       int32_t ch, int32_t sps, int32_t bps,
+                       pxtnRESAMPLE resample, bool b_loop) {
+  bool b_convert = (resample != pxtnRESAMPLE_nearest && p_pcm->get_sps() != sps);
+  int32_t smp_ch = p_pcm->get_ch();
+  int32_t smp_bps = b_convert ? bps : p_pcm->get_bps();
+  int32_t smp_sps = b_convert ? sps : p_pcm->get_sps();
+  if (smp_ch != 1) smp_ch = ch;
+  if (smp_bps != 8) smp_bps = bps;
+
+  if (!p_pcm->Convert(smp_ch, smp_sps, smp_bps, resample, b_loop)) return false;
+
+  int32_t frame_size = ch * bps / 8;
+  p_vi->smp_head_w = pxtnPulse_PCM::Convert_SampleNum(
+      p_pcm->get_smp_head(), frame_size, smp_sps, sps);
+  p_vi->smp_body_w = pxtnPulse_PCM::Convert_SampleNum(
+      p_pcm->get_smp_body(), frame_size, smp_sps, sps);
+  p_vi->smp_tail_w = pxtnPulse_PCM::Convert_SampleNum(
+      p_pcm->get_smp_tail(), frame_size, smp_sps, sps);
+  p_vi->smp_ch = smp_ch;
+  p_vi->smp_bps = smp_bps;
+  p_vi->smp_sps = smp_sps;
+  p_vi->smp_num =
+      p_pcm->get_smp_head() + p_pcm->get_smp_body() + p_pcm->get_smp_tail();
+  p_vi->p_smp_w = (uint8_t*)p_pcm->Devolve_SamplingBuffer();
+  return true;
+}
+
+pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr,
+                                     pxtnRESAMPLE resample) {
   pxtnERR res = pxtnERR_VOID;
   pxtnVOICEINSTANCE* p_vi = NULL;
   pxtnVOICEUNIT* p_vc = NULL;
@@ -334,10 +539,11 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
   int32_t ch = 2;
   int32_t sps = 44100;
   int32_t bps = 16;
+  bool b_cache = pxtnWoiceCache_get_enabled();
 
   for (int32_t v = 0; v < _voice_num; v++) {
     p_vi = &_voinsts[v];
-    pxtnMem_free((void**)&p_vi->p_smp_w);
+    _Free_Sample(p_vi);
     p_vi->smp_head_w = 0;
     p_vi->smp_body_w = 0;
     p_vi->smp_tail_w = 0;
@@ -347,17 +553,27 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
     p_vi = &_voinsts[v];
     p_vc = &_voices[v];
 
+    pxtnWOICEKEY key;
+    if (b_cache) {
+      key = _Sample_Key(p_vc, ch, sps, bps, resample);
+      const pxtnWOICEDATA* p_data = pxtnWoiceCache_Find(key);
+      if (p_data) {
+        _Use_Sample(p_vi, p_data);
+        continue;
+      }
+    }
+
     switch (p_vc->type) {
       case pxtnVOICE_OggVorbis:
 
 #ifdef pxINCLUDE_OGGVORBIS
         res = p_vc->p_oggv->Decode(&pcm_work);
         if (res != pxtnOK) goto term;
-        if (!pcm_work.Convert(ch, sps, bps)) goto term;
-        p_vi->smp_head_w = pcm_work.get_smp_head();
-        p_vi->smp_body_w = pcm_work.get_smp_body();
-        p_vi->smp_tail_w = pcm_work.get_smp_tail();
-        p_vi->p_smp_w = (uint8_t*)pcm_work.Devolve_SamplingBuffer();
+        if (!_Ready_PCM(&pcm_work, p_vi, ch, sps, bps, resample,
+                        p_vc->voice_flags & PTV_VOICEFLAG_WAVELOOP)) {
+          res = pxtnERR_pcm_convert;
+          goto term;
+        }
 #else
         res = pxtnERR_ogg_no_supported;
         goto term;
@@ -368,14 +584,11 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
 
         res = p_vc->p_pcm->Copy(&pcm_work);
         if (res != pxtnOK) goto term;
-        if (!pcm_work.Convert(ch, sps, bps)) {
+        if (!_Ready_PCM(&pcm_work, p_vi, ch, sps, bps, resample,
+                        p_vc->voice_flags & PTV_VOICEFLAG_WAVELOOP)) {
           res = pxtnERR_pcm_convert;
           goto term;
         }
-        p_vi->smp_head_w = pcm_work.get_smp_head();
-        p_vi->smp_body_w = pcm_work.get_smp_body();
-        p_vi->smp_tail_w = pcm_work.get_smp_tail();
-        p_vi->p_smp_w = (uint8_t*)pcm_work.Devolve_SamplingBuffer();
         break;
 
       case pxtnVOICE_Overtone:
@@ -387,7 +600,11 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
           goto term;
         }
         memset(p_vi->p_smp_w, 0x00, size);
-        _UpdateWavePTV(p_vc, p_vi, ch, sps, bps);
+        if (!_UpdateWavePTV(p_vc, p_vi, ch, sps, bps, b_cache)) {
+          res = pxtnERR_memory;
+          goto term;
+        }
+        _Set_Format(p_vi, ch, sps, bps);
         break;
       }
 
@@ -403,9 +620,17 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
         }
         p_vi->p_smp_w = (uint8_t*)p_pcm->Devolve_SamplingBuffer();
         p_vi->smp_body_w = p_vc->p_ptn->get_smp_num_44k();
+        _Set_Format(p_vi, ch, sps, bps);
+        SAFE_DELETE(p_pcm);
         break;
       }
     }
+
+    if (b_cache && p_vi->p_smp_w) {
+      pxtnWOICEDATA data = _Sample_Data(p_vi);
+      p_vi->p_smp_w = NULL;
+      _Use_Sample(p_vi, pxtnWoiceCache_Insert(key, data));
+    }
   }
 
   res = pxtnOK;
@@ -413,7 +638,7 @@ term:
   if (res != pxtnOK) {
     for (int32_t v = 0; v < _voice_num; v++) {
       p_vi = &_voinsts[v];
-      pxtnMem_free((void**)&p_vi->p_smp_w);
+      _Free_Sample(p_vi);
       p_vi->smp_head_w = 0;
       p_vi->smp_body_w = 0;
       p_vi->smp_tail_w = 0;
@@ -427,6 +652,7 @@ pxtnERR pxtnWoice::Tone_Ready_envelope(int32_t sps) {
   pxtnERR res = pxtnERR_VOID;
   int32_t e = 0;
   pxtnPOINT* p_point = NULL;
+  bool b_cache = pxtnWoiceCache_get_enabled();
 
   for (int32_t v = 0; v < _voice_num; v++) {
     pxtnVOICEINSTANCE* p_vi = &_voinsts[v];
@@ -434,54 +660,71 @@ pxtnERR pxtnWoice::Tone_Ready_envelope(int32_t sps) {
     pxtnVOICEENVELOPE* p_enve = &p_vc->envelope;
     int32_t size = 0;
 
-    pxtnMem_free((void**)&p_vi->p_env);
+    _Free_Envelope(p_vi);
 
     if (p_enve->head_num) {
       for (e = 0; e < p_enve->head_num; e++) size += p_enve->points[e].x;
       p_vi->env_size = (int32_t)((double)size * sps / p_enve->fps);
       if (!p_vi->env_size) p_vi->env_size = 1;
 
-      if (!pxtnMem_zero_alloc((void**)&p_vi->p_env, p_vi->env_size)) {
-        res = pxtnERR_memory;
-        goto term;
-      }
-      if (!pxtnMem_zero_alloc((void**)&p_point,
-                              sizeof(pxtnPOINT) * p_enve->head_num)) {
-        res = pxtnERR_memory;
-        goto term;
+      pxtnWOICEKEY key;
+      if (b_cache) {
+        key = _Envelope_Key(p_enve, sps);
+        p_vi->p_env_data = pxtnWoiceCache_Find(key);
       }
+      if (p_vi->p_env_data) {
+        p_vi->p_env = p_vi->p_env_data->p_buf;
+      } else {
+        if (!pxtnMem_zero_alloc((void**)&p_vi->p_env, p_vi->env_size)) {
+          res = pxtnERR_memory;
+          goto term;
+        }
+        if (!pxtnMem_zero_alloc((void**)&p_point,
+                                sizeof(pxtnPOINT) * p_enve->head_num)) {
+          res = pxtnERR_memory;
+          goto term;
+        }
 
-      // convert points.
-      int32_t offset = 0;
-      int32_t head_num = 0;
-      for (e = 0; e < p_enve->head_num; e++) {
-        if (!e || p_enve->points[e].x || p_enve->points[e].y) {
-          offset += (int32_t)((double)p_enve->points[e].x * sps / p_enve->fps);
-          p_point[e].x = offset;
-          p_point[e].y = p_enve->points[e].y;
-          head_num++;
+        // convert points.
+        int32_t offset = 0;
+        int32_t head_num = 0;
+        for (e = 0; e < p_enve->head_num; e++) {
+          if (!e || p_enve->points[e].x || p_enve->points[e].y) {
+            offset +=
+                (int32_t)((double)p_enve->points[e].x * sps / p_enve->fps);
+            p_point[e].x = offset;
+            p_point[e].y = p_enve->points[e].y;
+            head_num++;
+          }
         }
-      }
 
-      pxtnPOINT start;
-      e = start.x = start.y = 0;
-      for (int32_t s = 0; s < p_vi->env_size; s++) {
-        while (e < head_num && s >= p_point[e].x) {
-          start.x = p_point[e].x;
-          start.y = p_point[e].y;
-          e++;
+        pxtnPOINT start;
+        e = start.x = start.y = 0;
+        for (int32_t s = 0; s < p_vi->env_size; s++) {
+          while (e < head_num && s >= p_point[e].x) {
+            start.x = p_point[e].x;
+            start.y = p_point[e].y;
+            e++;
+          }
+
+          if (e < head_num) {
+            p_vi->p_env[s] =
+                (uint8_t)(start.y + (p_point[e].y - start.y) * (s - start.x) /
+                                        (p_point[e].x - start.x));
+          } else {
+            p_vi->p_env[s] = (uint8_t)start.y;
+          }
         }
 
-        if (e < head_num) {
-          p_vi->p_env[s] =
-              (uint8_t)(start.y + (p_point[e].y - start.y) * (s - start.x) /
-                                      (p_point[e].x - start.x));
-        } else {
-          p_vi->p_env[s] = (uint8_t)start.y;
+        pxtnMem_free((void**)&p_point);
+
+        if (b_cache) {
+          pxtnWOICEDATA data = {p_vi->p_env, p_vi->env_size, {0, 0, 0}};
+          p_vi->p_env = NULL;
+          p_vi->p_env_data = pxtnWoiceCache_Insert(key, data);
+          p_vi->p_env = p_vi->p_env_data->p_buf;
         }
       }
-
-      pxtnMem_free((void**)&p_point);
     }
 
     if (p_enve->tail_num) {
@@ -498,19 +741,175 @@ term:
   pxtnMem_free((void**)&p_point);
 
   if (res != pxtnOK) {
-    for (int32_t v = 0; v < _voice_num; v++)
-      pxtnMem_free((void**)&_voinsts[v].p_env);
+    for (int32_t v = 0; v < _voice_num; v++) _Free_Envelope(&_voinsts[v]);
   }
 
   return res;
 }
 
 pxtnERR pxtnWoice::Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr,
-                              int32_t sps) {
+                              int32_t sps, pxtnRESAMPLE resample) {
   pxtnERR res = pxtnERR_VOID;
-  res = Tone_Ready_sample(ptn_bldr);
+  _b_tone_ready = false;
+  res = Tone_Ready_sample(ptn_bldr, resample);
   if (res != pxtnOK) return res;
   res = Tone_Ready_envelope(sps);
   if (res != pxtnOK) return res;
+  _b_tone_ready.store(true, std::memory_order_release);
+  return pxtnOK;
+}
+
+// The ready voices, as Tone_Ready left them. Per voice: the sample's
+// head/body/tail/ch/bps/sps/num, its bytes, then the envelope's size and
+// release, and its bytes.
+bool pxtnWoice::Tone_Write(pxtnDescriptor* p_doc) const {
+  if (!is_tone_ready()) return false;
+  for (int32_t v = 0; v < _voice_num; v++) {
+    const pxtnVOICEINSTANCE* p_vi = &_voinsts[v];
+    int32_t info[7] = {p_vi->smp_head_w, p_vi->smp_body_w, p_vi->smp_tail_w,
+                       p_vi->smp_ch,     p_vi->smp_bps,     p_vi->smp_sps,
+                       p_vi->smp_num};
+    int32_t size = 0;
+    if (p_vi->p_smp_w) size = p_vi->smp_num * p_vi->smp_ch * p_vi->smp_bps / 8;
+    if (!p_doc->w_asfile(info, sizeof(info), 1)) return false;
+    if (!p_doc->w_asfile(&size, sizeof(int32_t), 1)) return false;
+    if (size && !p_doc->w_asfile(p_vi->p_smp_w, size, 1)) return false;
+
+    size = p_vi->p_env ? p_vi->env_size : 0;
+    if (!p_doc->w_asfile(&p_vi->env_size, sizeof(int32_t), 1)) return false;
+    if (!p_doc->w_asfile(&p_vi->env_release, sizeof(int32_t), 1)) return false;
+    if (!p_doc->w_asfile(&size, sizeof(int32_t), 1)) return false;
+    if (size && !p_doc->w_asfile(p_vi->p_env, size, 1)) return false;
+  }
+  return true;
+}
+
+// Reads back what Tone_Write wrote, in place of Tone_Ready. [sps] and
+// [resample] must be what the voices were readied with; they only key the
+// woice cache, which is shared with voices readied the usual way.
+pxtnERR pxtnWoice::Tone_Read(pxtnDescriptor* p_doc, int32_t sps,
+                             pxtnRESAMPLE resample) {
+  pxtnERR res = pxtnERR_VOID;
+  bool b_cache = pxtnWoiceCache_get_enabled();
+
+  _b_tone_ready = false;
+  for (int32_t v = 0; v < _voice_num; v++) {
+    _Free_Sample(&_voinsts[v]);
+    _Free_Envelope(&_voinsts[v]);
+  }
+
+  for (int32_t v = 0; v < _voice_num; v++) {
+    pxtnVOICEINSTANCE* p_vi = &_voinsts[v];
+    pxtnVOICEUNIT* p_vc = &_voices[v];
+    int32_t info[7];
+    int32_t size = 0;
+
+    if (!p_doc->r(info, sizeof(info), 1)) {
+      res = pxtnERR_desc_r;
+      goto term;
+    }
+    if (!p_doc->r(&size, sizeof(int32_t), 1)) {
+      res = pxtnERR_desc_r;
+      goto term;
+    }
+    if ((info[3] != 1 && info[3] != 2) || (info[4] != 8 && info[4] != 16) ||
+        info[5] <= 0 || info[6] < 0 ||
+        (size && size != info[6] * info[3] * info[4] / 8)) {
+      res = pxtnERR_inv_data;
+      goto term;
+    }
+    p_vi->smp_head_w = info[0];
+    p_vi->smp_body_w = info[1];
+    p_vi->smp_tail_w = info[2];
+    p_vi->smp_ch = info[3];
+    p_vi->smp_bps = info[4];
+    p_vi->smp_sps = info[5];
+    p_vi->smp_num = info[6];
+
+    if (size) {
+      pxtnWOICEKEY key;
+      const pxtnWOICEDATA* p_data = NULL;
+      if (b_cache) {
+        key = _Sample_Key(p_vc, 2, 44100, 16, resample);
+        p_data = pxtnWoiceCache_Find(key);
+      }
+      if (p_data) {
+        _Use_Sample(p_vi, p_data);
+        if (!p_doc->seek(pxtnSEEK_cur, size)) {
+          res = pxtnERR_desc_r;
+          goto term;
+        }
+      } else {
+        if (!(p_vi->p_smp_w = (uint8_t*)malloc(size))) {
+          res = pxtnERR_memory;
+          goto term;
+        }
+        if (!p_doc->r(p_vi->p_smp_w, size, 1)) {
+          res = pxtnERR_desc_r;
+          goto term;
+        }
+        if (b_cache) {
+          pxtnWOICEDATA data = _Sample_Data(p_vi);
+          p_vi->p_smp_w = NULL;
+          _Use_Sample(p_vi, pxtnWoiceCache_Insert(key, data));
+        }
+      }
+    }
+
+    if (!p_doc->r(&p_vi->env_size, sizeof(int32_t), 1) ||
+        !p_doc->r(&p_vi->env_release, sizeof(int32_t), 1) ||
+        !p_doc->r(&size, sizeof(int32_t), 1)) {
+      res = pxtnERR_desc_r;
+      goto term;
+    }
+    if (size < 0 || (size && size != p_vi->env_size)) {
+      res = pxtnERR_inv_data;
+      goto term;
+    }
+    if (size) {
+      pxtnWOICEKEY key;
+      if (b_cache) {
+        key = _Envelope_Key(&p_vc->envelope, sps);
+        p_vi->p_env_data = pxtnWoiceCache_Find(key);
+      }
+      if (p_vi->p_env_data) {
+        p_vi->p_env = p_vi->p_env_data->p_buf;
+        if (!p_doc->seek(pxtnSEEK_cur, size)) {
+          res = pxtnERR_desc_r;
+          goto term;
+        }
+      } else {
+        if (!(p_vi->p_env = (uint8_t*)malloc(size))) {
+          res = pxtnERR_memory;
+          goto term;
+        }
+        if (!p_doc->r(p_vi->p_env, size, 1)) {
+          res = pxtnERR_desc_r;
+          goto term;
+        }
+        if (b_cache) {
+          pxtnWOICEDATA data = {p_vi->p_env, size, {0, 0, 0}};
+          p_vi->p_env = NULL;
+          p_vi->p_env_data = pxtnWoiceCache_Insert(key, data);
+          p_vi->p_env = p_vi->p_env_data->p_buf;
+        }
+      }
+    }
+  }
+
+  res = pxtnOK;
+term:
+  if (res != pxtnOK) {
+    for (int32_t v = 0; v < _voice_num; v++) {
+      pxtnVOICEINSTANCE* p_vi = &_voinsts[v];
+      _Free_Sample(p_vi);
+      _Free_Envelope(p_vi);
+      p_vi->smp_head_w = 0;
+      p_vi->smp_body_w = 0;
+      p_vi->smp_tail_w = 0;
+    }
+    return res;
+  }
+  _b_tone_ready.store(true, std::memory_order_release);
   return pxtnOK;
 }
@@ -3,12 +3,15 @@
 #ifndef pxtnWoice_H
 #define pxtnWoice_H
 
+#include <atomic>
+
 #include "./pxtn.h"
 #include "./pxtnDescriptor.h"
 #include "./pxtnPulse_Noise.h"
 #include "./pxtnPulse_NoiseBuilder.h"
 #include "./pxtnPulse_Oggv.h"
 #include "./pxtnPulse_PCM.h"
+#include "./pxtnWoiceCache.h"
 
 #define pxtnMAX_TUNEWOICENAME 16  // fixture.
 
@@ -44,16 +47,48 @@ enum pxtnVOICETYPE {
 
 /* Contains parameters for how to play this voice - release, pcm data, etc. */
 typedef struct {
+  // in frames at 44100Hz, whatever the rate p_smp_w is stored at.
   int32_t smp_head_w;
   int32_t smp_body_w;
   int32_t smp_tail_w;
   uint8_t* p_smp_w;
+  // Format of p_smp_w, kept as small as it reads back the same as 44100Hz
+  // 16-bit stereo. Use pxtnVoice_GetFrame to read it.
+  int32_t smp_ch;
+  int32_t smp_bps;
+  int32_t smp_sps;
+  int32_t smp_num;  // frames in p_smp_w
 
   uint8_t* p_env;
   int32_t env_size;
   int32_t env_release;
+
+  // Set when p_smp_w / p_env belong to pxtnWoiceCache instead of this voice.
+  const pxtnWOICEDATA* p_smp_data;
+  const pxtnWOICEDATA* p_env_data;
 } pxtnVOICEINSTANCE;
 
+// Reads frame [pos] (at 44100Hz) of a ready voice as 16-bit left and right.
+// A voice stored at a lower rate was going to be converted by repeating
+// samples, so the same sample is picked here with the converter's arithmetic.
+inline void pxtnVoice_GetFrame(const pxtnVOICEINSTANCE* p_vi, int32_t pos,
+                               int32_t* p_l, int32_t* p_r) {
+  if (p_vi->smp_sps != 44100) {
+    pos = (int32_t)((double)pos * (double)p_vi->smp_sps / (double)44100);
+    if (pos >= p_vi->smp_num) pos = p_vi->smp_num - 1;
+  }
+  int32_t r = p_vi->smp_ch - 1;
+  if (p_vi->smp_bps == 16) {
+    const int16_t* p = (const int16_t*)p_vi->p_smp_w + pos * p_vi->smp_ch;
+    *p_l = p[0];
+    *p_r = p[r];
+  } else {
+    const uint8_t* p = p_vi->p_smp_w + pos * p_vi->smp_ch;
+    *p_l = ((int32_t)p[0] - 128) * 0x100;
+    *p_r = ((int32_t)p[r] - 128) * 0x100;
+  }
+}
+
 typedef struct {
   int32_t fps;
   int32_t head_num;
@@ -134,6 +169,10 @@ class pxtnWoice {
   float _x3x_tuning;
   int32_t _x3x_basic_key;  // tuning old-fmt when key-event
 
+  // Set once Tone_Ready succeeds. Voices may be readied on another thread
+  // while the song plays (see pxtnService::set_lazy_tones).
+  std::atomic<bool> _b_tone_ready;
+
  public:
   pxtnWoice();
   ~pxtnWoice();
@@ -142,6 +181,7 @@ class pxtnWoice {
   float get_x3x_tuning() const;
   int32_t get_x3x_basic_key() const;
   pxtnWOICETYPE get_type() const;
+  bool is_tone_ready() const;
   const pxtnVOICEUNIT* get_voice(int32_t idx) const;
   pxtnVOICEUNIT* get_voice_variable(int32_t idx);
 
@@ -175,9 +215,16 @@ class pxtnWoice {
   pxtnERR io_mateOGGV_r(pxtnDescriptor* p_doc);
 #endif
 
-  pxtnERR Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr);
+  pxtnERR Tone_Ready_sample(
+      const pxtnPulse_NoiseBuilder* ptn_bldr,
+      pxtnRESAMPLE resample = pxtnRESAMPLE_nearest);
   pxtnERR Tone_Ready_envelope(int32_t sps);
-  pxtnERR Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr, int32_t sps);
+  pxtnERR Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr, int32_t sps,
+                     pxtnRESAMPLE resample = pxtnRESAMPLE_nearest);
+
+  bool Tone_Write(pxtnDescriptor* p_doc) const;
+  pxtnERR Tone_Read(pxtnDescriptor* p_doc, int32_t sps,
+                    pxtnRESAMPLE resample = pxtnRESAMPLE_nearest);
 };
 
 #endif
@@ -0,0 +1,197 @@
+#include "./pxtnWoiceCache.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "./pxtnMem.h"
+
+#define _FNV_PRIME 0x100000001b3ULL
+#define _DEFAULT_BUDGET (32 * 1024 * 1024)
+
+pxtnWoiceKeyBuilder::pxtnWoiceKeyBuilder(char kind) {
+  _key.lo = 0xcbf29ce484222325ULL;
+  _key.hi = 0x84222325cbf29ce4ULL;
+  add(&kind, 1);
+}
+
+void pxtnWoiceKeyBuilder::add(const void *p, int32_t size) {
+  const uint8_t *p_byte = (const uint8_t *)p;
+  for (int32_t i = 0; i < size; i++) {
+    _key.lo = (_key.lo ^ p_byte[i]) * _FNV_PRIME;
+    _key.hi = (_key.hi ^ (uint8_t)(p_byte[i] + i)) * _FNV_PRIME;
+  }
+}
+
+void pxtnWoiceKeyBuilder::add_i32(int32_t v) { add(&v, sizeof(v)); }
+void pxtnWoiceKeyBuilder::add_f32(float v) { add(&v, sizeof(v)); }
+
+void pxtnWoiceKeyBuilder::add_points(const pxtnPOINT *points, int32_t num) {
+  add_i32(num);
+  for (int32_t i = 0; i < num; i++) {
+    add_i32(points[i].x);
+    add_i32(points[i].y);
+  }
+}
+
+const pxtnWOICEKEY &pxtnWoiceKeyBuilder::get() const { return _key; }
+
+namespace {
+
+struct _ENTRY : pxtnWOICEDATA {
+  pxtnWOICEKEY key;
+  int32_t ref;
+  std::list<_ENTRY *>::iterator lru;  // valid while ref is 0
+};
+
+struct _KEYHASH {
+  size_t operator()(const pxtnWOICEKEY &k) const { return (size_t)k.lo; }
+};
+struct _KEYEQUAL {
+  bool operator()(const pxtnWOICEKEY &a, const pxtnWOICEKEY &b) const {
+    return a.lo == b.lo && a.hi == b.hi;
+  }
+};
+
+struct _CACHE {
+  std::mutex mtx;
+  std::unordered_map<pxtnWOICEKEY, _ENTRY *, _KEYHASH, _KEYEQUAL> entries;
+  std::list<_ENTRY *> unused;  // most recently released first
+  bool b_enabled = true;
+  int64_t budget = _DEFAULT_BUDGET;
+  int64_t bytes = 0;
+  int64_t unused_bytes = 0;
+  int64_t shared_bytes = 0;
+  int64_t hit_num = 0;
+  int64_t miss_num = 0;
+};
+
+}  // namespace
+
+// Never destroyed, so voices freed during static destruction can still
+// release their entries.
+static _CACHE &_Cache() {
+  static _CACHE *p_cache = new _CACHE();
+  return *p_cache;
+}
+
+static void _Free_Entry(_CACHE &c, _ENTRY *p_ent) {
+  c.entries.erase(p_ent->key);
+  c.bytes -= p_ent->size;
+  pxtnMem_free((void **)&p_ent->p_buf);
+  delete p_ent;
+}
+
+static void _Trim(_CACHE &c, int64_t budget) {
+  while (c.unused_bytes > budget && !c.unused.empty()) {
+    _ENTRY *p_ent = c.unused.back();
+    c.unused.pop_back();
+    c.unused_bytes -= p_ent->size;
+    _Free_Entry(c, p_ent);
+  }
+}
+
+static void _AddRef(_CACHE &c, _ENTRY *p_ent) {
+  if (p_ent->ref == 0) {
+    c.unused.erase(p_ent->lru);
+    c.unused_bytes -= p_ent->size;
+  } else {
+    c.shared_bytes += p_ent->size;
+  }
+  p_ent->ref++;
+}
+
+const pxtnWOICEDATA *pxtnWoiceCache_Find(const pxtnWOICEKEY &key) {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  auto it = c.entries.find(key);
+  if (it == c.entries.end()) {
+    c.miss_num++;
+    return NULL;
+  }
+  c.hit_num++;
+  _AddRef(c, it->second);
+  return it->second;
+}
+
+const pxtnWOICEDATA *pxtnWoiceCache_Insert(const pxtnWOICEKEY &key,
+                                           const pxtnWOICEDATA &data) {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  auto it = c.entries.find(key);
+  if (it != c.entries.end()) {
+    uint8_t *p_buf = data.p_buf;
+    pxtnMem_free((void **)&p_buf);
+    _AddRef(c, it->second);
+    return it->second;
+  }
+
+  _ENTRY *p_ent = new _ENTRY();
+  *(pxtnWOICEDATA *)p_ent = data;
+  p_ent->key = key;
+  p_ent->ref = 1;
+  c.entries[key] = p_ent;
+  c.bytes += p_ent->size;
+  return p_ent;
+}
+
+void pxtnWoiceCache_Release(const pxtnWOICEDATA **pp_data) {
+  if (!pp_data || !*pp_data) return;
+  _ENTRY *p_ent = (_ENTRY *)static_cast<const _ENTRY *>(*pp_data);
+  *pp_data = NULL;
+
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  if (--p_ent->ref > 0) {
+    c.shared_bytes -= p_ent->size;
+    return;
+  }
+  c.unused.push_front(p_ent);
+  p_ent->lru = c.unused.begin();
+  c.unused_bytes += p_ent->size;
+  _Trim(c, c.budget);
+}
+
+void pxtnWoiceCache_set_enabled(bool b) {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  c.b_enabled = b;
+}
+
+bool pxtnWoiceCache_get_enabled() {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  return c.b_enabled;
+}
+
+void pxtnWoiceCache_set_budget(int64_t bytes) {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  c.budget = bytes < 0 ? 0 : bytes;
+  _Trim(c, c.budget);
+}
+
+int64_t pxtnWoiceCache_get_budget() {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  return c.budget;
+}
+
+void pxtnWoiceCache_Purge() {
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  _Trim(c, 0);
+}
+
+void pxtnWoiceCache_get_stats(pxtnWOICECACHESTATS *p_stats) {
+  if (!p_stats) return;
+  _CACHE &c = _Cache();
+  std::lock_guard<std::mutex> lock(c.mtx);
+  p_stats->entry_num = (int32_t)c.entries.size();
+  p_stats->used_entry_num = (int32_t)(c.entries.size() - c.unused.size());
+  p_stats->bytes = c.bytes;
+  p_stats->used_bytes = c.bytes - c.unused_bytes;
+  p_stats->shared_bytes = c.shared_bytes;
+  p_stats->hit_num = c.hit_num;
+  p_stats->miss_num = c.miss_num;
+}
@@ -0,0 +1,76 @@
+// pxtnWoiceCache: ready sample buffers and envelope tables, shared by every
+// voice in the process that has the same definition.
+
+#ifndef pxtnWoiceCache_H
+#define pxtnWoiceCache_H
+
+#include "./pxtn.h"
+
+// Digest of a voice definition plus the format it is readied for. Two
+// independent 64-bit FNV-1a lanes, so a false match between different
+// definitions isn't a practical concern.
+typedef struct {
+  uint64_t lo;
+  uint64_t hi;
+} pxtnWOICEKEY;
+
+class pxtnWoiceKeyBuilder {
+ private:
+  pxtnWOICEKEY _key;
+
+ public:
+  pxtnWoiceKeyBuilder(char kind);
+
+  void add(const void *p, int32_t size);
+  void add_i32(int32_t v);
+  void add_f32(float v);
+  void add_points(const pxtnPOINT *points, int32_t num);
+
+  const pxtnWOICEKEY &get() const;
+};
+
+// A buffer owned by the cache. Nothing may write to it once shared.
+typedef struct {
+  uint8_t *p_buf;
+  int32_t size;
+  // for samples: smp_head_w, smp_body_w, smp_tail_w, smp_ch, smp_bps, smp_sps,
+  // smp_num.
+  int32_t info[7];
+} pxtnWOICEDATA;
+
+// Returns the entry for [key] with a reference taken, or NULL.
+const pxtnWOICEDATA *pxtnWoiceCache_Find(const pxtnWOICEKEY &key);
+// Hands [data] (its buffer malloc'ed) over to the cache and returns the shared
+// entry with a reference taken. If another thread added [key] first, the
+// buffer in [data] is freed and that entry is returned instead.
+const pxtnWOICEDATA *pxtnWoiceCache_Insert(const pxtnWOICEKEY &key,
+                                           const pxtnWOICEDATA &data);
+// Gives back a reference and clears *pp_data.
+void pxtnWoiceCache_Release(const pxtnWOICEDATA **pp_data);
+
+// When off, voices own their buffers as they used to. Only affects voices
+// readied afterwards. On by default.
+void pxtnWoiceCache_set_enabled(bool b);
+bool pxtnWoiceCache_get_enabled();
+
+// Entries no voice refers to any more are kept for songs loaded later, up to
+// [bytes] in total; past that the least recently released are freed first.
+// Entries still in use are never freed.
+void pxtnWoiceCache_set_budget(int64_t bytes);
+int64_t pxtnWoiceCache_get_budget();
+// Frees every entry not in use.
+void pxtnWoiceCache_Purge();
+
+typedef struct {
+  int32_t entry_num;
+  int32_t used_entry_num;  // entries some voice refers to
+  int64_t bytes;           // held by all entries
+  int64_t used_bytes;      // held by entries in use
+  int64_t shared_bytes;    // would be allocated again without the cache
+  int64_t hit_num;
+  int64_t miss_num;
+} pxtnWOICECACHESTATS;
+
+void pxtnWoiceCache_get_stats(pxtnWOICECACHESTATS *p_stats);
+
+#endif
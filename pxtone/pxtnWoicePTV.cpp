@@ -8,7 +8,7 @@
 static const char *_code = "PTVOICE-";
 //             _version  =  20050826;
 //             _version  =  20051101; // support coodinate
-static int32_t _version = 20060111;  // support no-envelope
+static const int32_t _version = 20060111;  // support no-envelope
 
 static bool _Write_Wave(pxtnDescriptor *p_doc, const pxtnVOICEUNIT *p_vc,
                         int32_t *p_total) {
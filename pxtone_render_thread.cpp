@@ -0,0 +1,91 @@
+/*************************************************************************/
+/*  pxtone_render_thread.cpp                                             */
+/*************************************************************************/
+/* Copyright (c) 2007-2025 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2025 Godot Engine contributors (cf. AUTHORS.md).   */
+/* Copyright (c) 2022-2025 Alula, Xysspon LLC                            */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "pxtone_render_thread.h"
+
+#include "audio_stream_pxtone.h"
+
+#include "core/os/os.h"
+
+PxToneRenderThread *PxToneRenderThread::singleton = nullptr;
+
+PxToneRenderThread *PxToneRenderThread::get_singleton() {
+	return singleton;
+}
+
+void PxToneRenderThread::_thread_func(void *p_self) {
+	PxToneRenderThread *self = static_cast<PxToneRenderThread *>(p_self);
+
+	while (!self->exit_thread.is_set()) {
+		uint64_t sleep_usec;
+		{
+			MutexLock lock(self->mutex);
+			for (AudioStreamPlaybackPxTone *playback : self->playbacks) {
+				playback->_render_ahead();
+			}
+			sleep_usec = self->sleep_usec;
+		}
+		OS::get_singleton()->delay_usec(sleep_usec);
+	}
+}
+
+void PxToneRenderThread::add_playback(AudioStreamPlaybackPxTone *p_playback) {
+	MutexLock lock(mutex);
+	if (playbacks.has(p_playback)) {
+		return;
+	}
+	playbacks.push_back(p_playback);
+
+	// Wake up often enough to top up the playback with the least latency.
+	uint64_t latency_usec = uint64_t(p_playback->get_render_ahead_latency() * 1000000.0);
+	sleep_usec = MAX(uint64_t(1000), MIN(sleep_usec, latency_usec / 4));
+
+	if (!thread.is_started()) {
+		exit_thread.clear();
+		thread.start(_thread_func, this);
+	}
+}
+
+void PxToneRenderThread::remove_playback(AudioStreamPlaybackPxTone *p_playback) {
+	MutexLock lock(mutex);
+	playbacks.erase(p_playback);
+	if (playbacks.is_empty()) {
+		sleep_usec = 5000;
+	}
+}
+
+PxToneRenderThread::PxToneRenderThread() {
+	singleton = this;
+}
+
+PxToneRenderThread::~PxToneRenderThread() {
+	exit_thread.set();
+	if (thread.is_started()) {
+		thread.wait_to_finish();
+	}
+	singleton = nullptr;
+}
@@ -0,0 +1,61 @@
+/*************************************************************************/
+/*  pxtone_render_thread.h                                               */
+/*************************************************************************/
+/* Copyright (c) 2007-2025 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2025 Godot Engine contributors (cf. AUTHORS.md).   */
+/* Copyright (c) 2022-2025 Alula, Xysspon LLC                            */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef PXTONE_RENDER_THREAD_H
+#define PXTONE_RENDER_THREAD_H
+
+#include "core/os/mutex.h"
+#include "core/os/thread.h"
+#include "core/templates/local_vector.h"
+#include "core/templates/safe_refcount.h"
+
+class AudioStreamPlaybackPxTone;
+
+// Renders playbacks that use render-ahead into their ring buffers, away from
+// the audio mix thread. One thread is shared by all playbacks.
+class PxToneRenderThread {
+	static PxToneRenderThread *singleton;
+
+	Thread thread;
+	SafeFlag exit_thread;
+	Mutex mutex;
+	LocalVector<AudioStreamPlaybackPxTone *> playbacks;
+	uint64_t sleep_usec = 5000;
+
+	static void _thread_func(void *p_self);
+
+public:
+	static PxToneRenderThread *get_singleton();
+
+	void add_playback(AudioStreamPlaybackPxTone *p_playback);
+	void remove_playback(AudioStreamPlaybackPxTone *p_playback);
+
+	PxToneRenderThread();
+	~PxToneRenderThread();
+};
+
+#endif // PXTONE_RENDER_THREAD_H
@@ -28,12 +28,15 @@
 #include "register_types.h"
 
 #include "audio_stream_pxtone.h"
+#include "pxtone_render_thread.h"
 
 #ifdef TOOLS_ENABLED
 #include "core/config/engine.h"
 #include "resource_importer_pxtone.h"
 #endif
 
+static PxToneRenderThread *render_thread = nullptr;
+
 void initialize_pxtone_module(ModuleInitializationLevel p_level) {
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
@@ -47,10 +50,17 @@ void initialize_pxtone_module(ModuleInitializationLevel p_level) {
 	}
 #endif
 	GDREGISTER_CLASS(AudioStreamPxTone);
+
+	render_thread = memnew(PxToneRenderThread);
 }
 
 void uninitialize_pxtone_module(ModuleInitializationLevel p_level) {
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
+
+	if (render_thread) {
+		memdelete(render_thread);
+		render_thread = nullptr;
+	}
 }
@@ -29,6 +29,7 @@
 
 #include "core/io/file_access.h"
 #include "core/io/resource_saver.h"
+#include "core/os/os.h"
 #include "scene/resources/texture.h"
 
 String ResourceImporterPxTone::get_importer_name() const {
@@ -67,11 +68,21 @@ String ResourceImporterPxTone::get_preset_name(int p_idx) const {
 void ResourceImporterPxTone::get_import_options(const String &p_path, List<ImportOption> *r_options, int p_preset) const {
 	r_options->push_back(ImportOption(PropertyInfo(Variant::BOOL, "loop"), true));
 	r_options->push_back(ImportOption(PropertyInfo(Variant::FLOAT, "loop_offset"), 0));
+	r_options->push_back(ImportOption(PropertyInfo(Variant::INT, "loop_cache_mode", PROPERTY_HINT_ENUM, "Disabled,On Play,On Load"), AudioStreamPxTone::LOOP_CACHE_MODE_DISABLED));
+	r_options->push_back(ImportOption(PropertyInfo(Variant::BOOL, "compile_woices"), false));
+}
+
+// Each import readies its own song, and pxtone keeps no state between songs
+// other than read-only tables and the locked woice cache.
+bool ResourceImporterPxTone::can_import_threaded() const {
+	return true;
 }
 
 Error ResourceImporterPxTone::import(ResourceUID::ID p_source_id, const String &p_source_file, const String &p_save_path, const HashMap<StringName, Variant> &p_options, List<String> *r_platform_variants, List<String> *r_gen_files, Variant *r_metadata) {
 	bool loop = p_options["loop"];
 	float loop_offset = p_options["loop_offset"];
+	AudioStreamPxTone::LoopCacheMode loop_cache_mode = (AudioStreamPxTone::LoopCacheMode)(int)p_options["loop_cache_mode"];
+	bool compile_woices = p_options["compile_woices"];
 
 	Ref<FileAccess> f = FileAccess::open(p_source_file, FileAccess::READ);
 	ERR_FAIL_COND_V(f.is_null(), ERR_CANT_OPEN);
@@ -84,13 +95,26 @@ Error ResourceImporterPxTone::import(ResourceUID::ID p_source_id, const String &
 
 	f->get_buffer(w, len);
 
+	// Imports of several files run in parallel, each on its own stream.
 	Ref<AudioStreamPxTone> pxtn_stream;
 	pxtn_stream.instantiate();
 
+	uint64_t parse_start = OS::get_singleton()->get_ticks_usec();
 	pxtn_stream->set_data(data);
 	ERR_FAIL_COND_V(!pxtn_stream->get_data().size(), ERR_FILE_CORRUPT);
+	uint64_t prepare_start = OS::get_singleton()->get_ticks_usec();
+	if (compile_woices) {
+		Error err = pxtn_stream->compile_woices();
+		ERR_FAIL_COND_V(err != OK, err);
+	}
+	uint64_t prepare_end = OS::get_singleton()->get_ticks_usec();
+
+	print_verbose(vformat("PxTone: Imported \"%s\": parse %.1f ms, prepare %.1f ms, %d bytes of song data, %d bytes of compiled woices.",
+			p_source_file, (prepare_start - parse_start) / 1000.0, (prepare_end - prepare_start) / 1000.0,
+			pxtn_stream->get_data().size(), pxtn_stream->get_compiled_woices().size()));
 	pxtn_stream->set_loop(loop);
 	pxtn_stream->set_loop_offset(loop_offset);
+	pxtn_stream->set_loop_cache_mode(loop_cache_mode);
 
 	return ResourceSaver::save(pxtn_stream, p_save_path + ".ptstr");
 }